@@ -0,0 +1,56 @@
+#include "arena.hpp"
+#include <algorithm>
+
+Arena::Arena(size_t block_size)
+    : block_size_(std::max<size_t>(block_size, 64)), current_(nullptr), memory_usage_(0) {
+}
+
+Arena::~Arena() {
+    for (Block* block : blocks_) {
+        delete[] block->data;
+        delete block;
+    }
+}
+
+char* Arena::allocate(size_t bytes) {
+    const size_t align = alignof(void*);
+    bytes = (bytes + align - 1) & ~(align - 1);
+
+    // Big allocations get a block of their own so they don't waste the
+    // rest of the shared one
+    if (bytes > block_size_ / 4) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Block* block = new_block(bytes);
+        block->used.store(bytes);
+        return block->data;
+    }
+
+    while (true) {
+        Block* block = current_.load(std::memory_order_acquire);
+        if (block != nullptr) {
+            size_t offset = block->used.fetch_add(bytes);
+            if (offset + bytes <= block->size) {
+                return block->data + offset;
+            }
+        }
+
+        // Block is full (or missing); whoever gets here first installs the next one
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (current_.load(std::memory_order_relaxed) == block) {
+            current_.store(new_block(block_size_), std::memory_order_release);
+        }
+    }
+}
+
+size_t Arena::memory_usage() const {
+    return memory_usage_.load(std::memory_order_relaxed);
+}
+
+Arena::Block* Arena::new_block(size_t size) {
+    Block* block = new Block;
+    block->size = size;
+    block->data = new char[size];
+    blocks_.push_back(block);
+    memory_usage_.fetch_add(size + sizeof(Block), std::memory_order_relaxed);
+    return block;
+}
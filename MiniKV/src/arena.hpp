@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Bump allocator carving memory out of large blocks, all freed together when
+// the arena goes away. allocate() is safe to call from several threads: the
+// common case is a single fetch_add, and only starting a new block locks.
+// No memory is taken until the first allocation.
+class Arena {
+public:
+    static constexpr size_t kDefaultBlockSize = 4096;
+
+    explicit Arena(size_t block_size = kDefaultBlockSize);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Returns memory aligned for any pointer-sized type
+    char* allocate(size_t bytes);
+
+    // Bytes of all blocks held, including unused tails
+    size_t memory_usage() const;
+
+private:
+    struct Block {
+        std::atomic<size_t> used{0};
+        size_t size = 0;
+        char* data = nullptr;
+    };
+
+    const size_t block_size_;
+    std::atomic<Block*> current_;
+    std::atomic<size_t> memory_usage_;
+    std::mutex mutex_;            // guards blocks_ and replacing current_
+    std::vector<Block*> blocks_;
+
+    Block* new_block(size_t size);
+};
@@ -0,0 +1,450 @@
+#include "kvstore.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string benchmarks = "fillseq,fillrandom,overwrite,readrandom,multireadrandom,readseq,"
+                             "readmissing,deleterandom,readrandomwriterandom";
+    std::string db = "./minikv_bench_data";
+    size_t num = 1000000;    // keys in the dataset
+    size_t reads = 0;        // ops per read benchmark; 0 means num
+    size_t key_size = 16;
+    size_t value_size = 100;
+    int threads = 1;
+    int read_percent = 90;   // readrandomwriterandom mix
+    size_t batch_size = 100; // keys per multireadrandom call
+    uint64_t seed = 301;
+    Options store;
+};
+
+// Values come from one random buffer that compresses to about half its
+// size, so LZ blocks behave roughly as they would on real data
+class ValueGenerator {
+public:
+    explicit ValueGenerator(uint64_t seed) {
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<int> byte(' ', '~');
+        std::string piece;
+        while (data_.size() < 1024 * 1024) {
+            piece.clear();
+            for (int i = 0; i < 50; ++i) piece.push_back(static_cast<char>(byte(rng)));
+            data_ += piece;
+            data_ += piece;
+        }
+    }
+
+    std::string_view next(size_t len) {
+        if (pos_ + len > data_.size()) pos_ = 0;
+        std::string_view value(data_.data() + pos_, len);
+        pos_ += len;
+        return value;
+    }
+
+private:
+    std::string data_;
+    size_t pos_ = 0;
+};
+
+// Per-thread results. Latencies are kept whole and sorted at the end, which
+// costs 8 bytes per op but gives exact percentiles.
+struct Stats {
+    size_t ops = 0;
+    size_t bytes = 0;
+    size_t found = 0;
+    std::vector<uint64_t> latencies_ns;
+
+    void merge(const Stats& other) {
+        ops += other.ops;
+        bytes += other.bytes;
+        found += other.found;
+        latencies_ns.insert(latencies_ns.end(), other.latencies_ns.begin(), other.latencies_ns.end());
+    }
+};
+
+class Benchmark {
+public:
+    explicit Benchmark(const BenchOptions& options) : options_(options) {
+        if (options_.reads == 0) options_.reads = options_.num;
+        options_.threads = std::max(options_.threads, 1);
+    }
+
+    bool run() {
+        print_header();
+        open(false);
+        for (const std::string& name : split_names(options_.benchmarks)) {
+            void (Benchmark::*method)(int, Stats&) = nullptr;
+            bool fresh = false;
+            if (name == "fillseq") {
+                method = &Benchmark::fill_seq;
+                fresh = true;
+            } else if (name == "fillrandom") {
+                method = &Benchmark::fill_random;
+                fresh = true;
+            } else if (name == "overwrite") {
+                method = &Benchmark::fill_random;
+            } else if (name == "readrandom") {
+                method = &Benchmark::read_random;
+            } else if (name == "multireadrandom") {
+                method = &Benchmark::multi_read_random;
+            } else if (name == "readseq") {
+                method = &Benchmark::read_seq;
+            } else if (name == "readmissing") {
+                method = &Benchmark::read_missing;
+            } else if (name == "deleterandom") {
+                method = &Benchmark::delete_random;
+            } else if (name == "readrandomwriterandom") {
+                method = &Benchmark::read_random_write_random;
+            } else if (name == "flush") {
+                store_->flush_memtable();
+                continue;
+            } else if (name == "compact") {
+                store_->compact();
+                continue;
+            } else {
+                std::cerr << "minikv_bench: unknown benchmark '" << name << "'\n";
+                return false;
+            }
+            if (fresh) open(true);
+            run_benchmark(name, method);
+        }
+        store_.reset();
+        return true;
+    }
+
+private:
+    BenchOptions options_;
+    std::unique_ptr<KVStore> store_;
+
+    static std::vector<std::string> split_names(const std::string& list) {
+        std::vector<std::string> names;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) names.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return names;
+    }
+
+    // Fill benchmarks start from an empty store, as their names promise
+    void open(bool destroy) {
+        store_.reset();
+        if (destroy) {
+            std::filesystem::remove_all(options_.db);
+        }
+        store_ = std::make_unique<KVStore>(options_.db, options_.store);
+    }
+
+    // Zero-padded so key order matches numeric order
+    std::string make_key(uint64_t n) const {
+        std::string digits = std::to_string(n);
+        if (digits.size() >= options_.key_size) return digits;
+        return std::string(options_.key_size - digits.size(), '0') + digits;
+    }
+
+    // The share of `total` ops thread t runs
+    size_t ops_for_thread(size_t total, int t) const {
+        size_t per = total / options_.threads;
+        return per + (static_cast<size_t>(t) < total % options_.threads ? 1 : 0);
+    }
+
+    template <typename Op>
+    void timed(Stats& stats, Op&& op) {
+        auto start = Clock::now();
+        op();
+        stats.latencies_ns.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        stats.ops++;
+    }
+
+    void fill_seq(int t, Stats& stats) {
+        // Each thread writes its own contiguous run of keys
+        size_t first = 0;
+        for (int i = 0; i < t; ++i) first += ops_for_thread(options_.num, i);
+        size_t count = ops_for_thread(options_.num, t);
+        ValueGenerator values(options_.seed + t);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key = make_key(first + i);
+            std::string_view value = values.next(options_.value_size);
+            timed(stats, [&] { store_->put(key, std::string(value)); });
+            stats.bytes += key.size() + value.size();
+        }
+    }
+
+    void fill_random(int t, Stats& stats) {
+        std::mt19937_64 rng(options_.seed + t);
+        ValueGenerator values(options_.seed + t);
+        size_t count = ops_for_thread(options_.num, t);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key = make_key(rng() % options_.num);
+            std::string_view value = values.next(options_.value_size);
+            timed(stats, [&] { store_->put(key, std::string(value)); });
+            stats.bytes += key.size() + value.size();
+        }
+    }
+
+    void read_random(int t, Stats& stats) {
+        std::mt19937_64 rng(options_.seed + 1000 + t);
+        std::string value;
+        size_t count = ops_for_thread(options_.reads, t);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key = make_key(rng() % options_.num);
+            bool found = false;
+            timed(stats, [&] { found = store_->get(key, value); });
+            if (found) {
+                stats.found++;
+                stats.bytes += key.size() + value.size();
+            }
+        }
+    }
+
+    // readrandom's keys, fetched batch_size at a time; latencies are per
+    // batch, throughput per key
+    void multi_read_random(int t, Stats& stats) {
+        std::mt19937_64 rng(options_.seed + 1000 + t);
+        size_t count = ops_for_thread(options_.reads, t);
+        std::vector<std::string> keys;
+        for (size_t done = 0; done < count; done += keys.size()) {
+            keys.clear();
+            for (size_t i = done; i < count && keys.size() < options_.batch_size; ++i) {
+                keys.push_back(make_key(rng() % options_.num));
+            }
+            std::vector<std::optional<std::string>> values;
+            timed(stats, [&] { values = store_->multi_get(keys); });
+            stats.ops += keys.size() - 1;
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (values[i]) {
+                    stats.found++;
+                    stats.bytes += keys[i].size() + values[i]->size();
+                }
+            }
+        }
+    }
+
+    // Keys that sort among the real ones but never exist, so every lookup
+    // goes through the memtable, the bloom filters and maybe a block
+    void read_missing(int t, Stats& stats) {
+        std::mt19937_64 rng(options_.seed + 2000 + t);
+        std::string value;
+        size_t count = ops_for_thread(options_.reads, t);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key = make_key(rng() % options_.num) + ".";
+            bool found = false;
+            timed(stats, [&] { found = store_->get(key, value); });
+            if (found) stats.found++;
+        }
+    }
+
+    void read_seq(int /*t*/, Stats& stats) {
+        // Every thread scans from the start; the iterator is per thread
+        auto it = store_->new_iterator();
+        auto start = Clock::now();
+        it->seek_to_first();
+        size_t count = 0;
+        while (count < options_.reads && it->valid()) {
+            stats.bytes += it->key().size() + it->value().size();
+            count++;
+            auto now = Clock::now();
+            stats.latencies_ns.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+            stats.ops++;
+            start = now;
+            it->next();
+        }
+        stats.found = count;
+    }
+
+    void delete_random(int t, Stats& stats) {
+        std::mt19937_64 rng(options_.seed + 3000 + t);
+        size_t count = ops_for_thread(options_.num, t);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key = make_key(rng() % options_.num);
+            timed(stats, [&] { store_->remove(key); });
+            stats.bytes += key.size();
+        }
+    }
+
+    void read_random_write_random(int t, Stats& stats) {
+        std::mt19937_64 rng(options_.seed + 4000 + t);
+        ValueGenerator values(options_.seed + t);
+        std::string value;
+        size_t count = ops_for_thread(options_.reads, t);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key = make_key(rng() % options_.num);
+            if (static_cast<int>(rng() % 100) < options_.read_percent) {
+                bool found = false;
+                timed(stats, [&] { found = store_->get(key, value); });
+                if (found) {
+                    stats.found++;
+                    stats.bytes += key.size() + value.size();
+                }
+            } else {
+                std::string_view v = values.next(options_.value_size);
+                timed(stats, [&] { store_->put(key, std::string(v)); });
+                stats.bytes += key.size() + v.size();
+            }
+        }
+    }
+
+    void run_benchmark(const std::string& name, void (Benchmark::*method)(int, Stats&)) {
+        std::vector<Stats> stats(options_.threads);
+        std::vector<std::thread> threads;
+        std::atomic<int> ready{0};
+        std::atomic<bool> go{false};
+        for (int t = 0; t < options_.threads; ++t) {
+            threads.emplace_back([&, t] {
+                stats[t].latencies_ns.reserve(ops_for_thread(std::max(options_.num, options_.reads), t));
+                ready++;
+                while (!go.load()) std::this_thread::yield();
+                (this->*method)(t, stats[t]);
+            });
+        }
+        while (ready.load() < options_.threads) std::this_thread::yield();
+        auto start = Clock::now();
+        go = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        Stats total;
+        for (const Stats& s : stats) {
+            total.merge(s);
+        }
+        report(name, total, seconds);
+    }
+
+    void report(const std::string& name, Stats& total, double seconds) {
+        auto& lat = total.latencies_ns;
+        std::sort(lat.begin(), lat.end());
+        auto percentile = [&lat](double p) {
+            if (lat.empty()) return 0.0;
+            size_t i = std::min(lat.size() - 1, static_cast<size_t>(p / 100.0 * lat.size()));
+            return lat[i] / 1000.0;
+        };
+
+        double ops_per_sec = seconds > 0 ? total.ops / seconds : 0;
+        double mb_per_sec = seconds > 0 ? total.bytes / (1024.0 * 1024.0) / seconds : 0;
+        std::printf("%-22s : %10.0f ops/sec %8.1f MB/s  p50 %8.2f us  p99 %8.2f us  p99.9 %8.2f us",
+                    name.c_str(), ops_per_sec, mb_per_sec, percentile(50), percentile(99),
+                    percentile(99.9));
+        if (name.find("read") != std::string::npos) {
+            std::printf("  (%zu of %zu found)", total.found, total.ops);
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+    }
+
+    void print_header() const {
+        std::printf("Keys:       %zu bytes each\n", options_.key_size);
+        std::printf("Values:     %zu bytes each\n", options_.value_size);
+        std::printf("Entries:    %zu\n", options_.num);
+        std::printf("Reads:      %zu\n", options_.reads);
+        std::printf("Threads:    %d\n", options_.threads);
+        std::printf("Raw size:   %.1f MB\n",
+                    (options_.key_size + options_.value_size) * options_.num / (1024.0 * 1024.0));
+        std::printf("Compression: %s\n",
+                    options_.store.compression == kNoCompression ? "none" : "lz");
+        std::printf("------------------------------------------------\n");
+    }
+};
+
+void print_usage() {
+    std::cout << "Usage: minikv_bench [options]\n";
+    std::cout << "  --benchmarks <list>   Comma-separated, run in order (default: all)\n";
+    std::cout << "                        fillseq, fillrandom    write num keys into an empty store\n";
+    std::cout << "                        overwrite              rewrite num random keys\n";
+    std::cout << "                        readrandom             get random existing keys\n";
+    std::cout << "                        multireadrandom        readrandom in batches, see --batch_size\n";
+    std::cout << "                        readseq                scan the store in order\n";
+    std::cout << "                        readmissing            get keys that don't exist\n";
+    std::cout << "                        deleterandom           remove num random keys\n";
+    std::cout << "                        readrandomwriterandom  gets and puts, see --read_percent\n";
+    std::cout << "                        flush, compact         run the store operation, untimed\n";
+    std::cout << "  --num <n>             Keys in the dataset (default 1000000)\n";
+    std::cout << "  --reads <n>           Ops per read benchmark (default: num)\n";
+    std::cout << "  --key_size <n>        Key bytes (default 16)\n";
+    std::cout << "  --value_size <n>      Value bytes (default 100)\n";
+    std::cout << "  --threads <n>         Client threads sharing the ops (default 1)\n";
+    std::cout << "  --read_percent <n>    Reads in readrandomwriterandom (default 90)\n";
+    std::cout << "  --batch_size <n>      Keys per multireadrandom call (default 100)\n";
+    std::cout << "  --compression <c>     none or lz (default lz)\n";
+    std::cout << "  --cache_size <bytes>  Block cache budget (default 8MB)\n";
+    std::cout << "  --write_buffer_size <bytes>  Memtable size limit (default 1MB)\n";
+    std::cout << "  --min_blob_size <bytes>  Store values this large in blob files (default 0, off)\n";
+    std::cout << "  --db <path>           Data directory (default ./minikv_bench_data)\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            print_usage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--benchmarks") {
+            options.benchmarks = value;
+        } else if (arg == "--num") {
+            options.num = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--reads") {
+            options.reads = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--key_size") {
+            options.key_size = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--value_size") {
+            options.value_size = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--threads") {
+            options.threads = std::atoi(value.c_str());
+        } else if (arg == "--read_percent") {
+            options.read_percent = std::atoi(value.c_str());
+        } else if (arg == "--batch_size") {
+            options.batch_size = std::max<size_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+        } else if (arg == "--compression") {
+            if (value == "none") {
+                options.store.compression = kNoCompression;
+            } else if (value == "lz") {
+                options.store.compression = kLZCompression;
+            } else {
+                print_usage();
+                return 1;
+            }
+        } else if (arg == "--cache_size") {
+            options.store.block_cache_size = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--min_blob_size") {
+            options.store.min_blob_size = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--write_buffer_size") {
+            options.store.memtable_size_limit = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--db") {
+            options.db = value;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (options.num == 0) {
+        print_usage();
+        return 1;
+    }
+
+    Benchmark bench(options);
+    return bench.run() ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#include "blob.hpp"
+#include <cstring>
+#include <filesystem>
+
+namespace {
+
+constexpr char kBlobMagic[] = "MKVBLOB1";
+constexpr size_t kHeaderSize = sizeof(kBlobMagic) - 1;
+constexpr size_t kChecksumSize = sizeof(uint32_t);
+constexpr uint32_t kChecksumSeed = 0x626c6f62;  // "blob"
+
+uint32_t record_checksum(const char* data, size_t n) {
+    return utils::hash(data, n, kChecksumSeed);
+}
+
+// Splits a checksummed record into key and value
+bool parse_record(std::string_view record, std::string_view& key, std::string_view& value) {
+    if (record.size() < kChecksumSize) {
+        return false;
+    }
+    uint32_t checksum;
+    std::memcpy(&checksum, record.data(), sizeof(checksum));
+    const char* p = record.data() + kChecksumSize;
+    const char* limit = record.data() + record.size();
+    if (record_checksum(p, limit - p) != checksum) {
+        return false;
+    }
+    uint64_t key_len, value_len;
+    if (!utils::get_varint(p, limit, key_len) || !utils::get_varint(p, limit, value_len) ||
+        key_len > static_cast<uint64_t>(limit - p) || value_len != static_cast<uint64_t>(limit - p) - key_len) {
+        return false;
+    }
+    key = std::string_view(p, key_len);
+    value = std::string_view(p + key_len, value_len);
+    return true;
+}
+
+}
+
+void BlobIndex::encode_to(std::string& out) const {
+    utils::put_varint(out, file_number);
+    utils::put_varint(out, offset);
+    utils::put_varint(out, size);
+}
+
+bool BlobIndex::decode_from(std::string_view in) {
+    const char* p = in.data();
+    const char* limit = p + in.size();
+    return utils::get_varint(p, limit, file_number) && utils::get_varint(p, limit, offset) &&
+           utils::get_varint(p, limit, size) && p == limit;
+}
+
+BlobFileBuilder::BlobFileBuilder(const std::string& filename, uint64_t file_number)
+    : filename_(filename), file_number_(file_number), offset_(0) {
+}
+
+bool BlobFileBuilder::add(std::string_view key, std::string_view value, BlobIndex& index) {
+    record_.assign(kChecksumSize, '\0');
+    utils::put_varint(record_, key.size());
+    utils::put_varint(record_, value.size());
+    record_.append(key);
+    record_.append(value);
+    uint32_t checksum = record_checksum(record_.data() + kChecksumSize, record_.size() - kChecksumSize);
+    std::memcpy(&record_[0], &checksum, sizeof(checksum));
+    return add_record(record_, index);
+}
+
+bool BlobFileBuilder::add_record(std::string_view record, BlobIndex& index) {
+    if (!file_.is_open()) {
+        file_.open(filename_, std::ios::binary | std::ios::trunc);
+        file_.write(kBlobMagic, kHeaderSize);
+        offset_ = kHeaderSize;
+    }
+    file_.write(record.data(), record.size());
+    if (!file_) {
+        return false;
+    }
+    index.file_number = file_number_;
+    index.offset = offset_;
+    index.size = record.size();
+    offset_ += record.size();
+    return true;
+}
+
+bool BlobFileBuilder::finish() {
+    if (!file_.is_open()) {
+        return true;
+    }
+    file_.close();
+    return file_.good() && utils::sync_file(filename_);
+}
+
+bool BlobFileBuilder::empty() const {
+    return offset_ == 0;
+}
+
+const std::string& BlobFileBuilder::filename() const {
+    return filename_;
+}
+
+uint64_t BlobFileBuilder::data_size() const {
+    return empty() ? 0 : offset_ - kHeaderSize;
+}
+
+BlobFile::BlobFile(const std::string& filename, uint64_t file_number)
+    : filename_(filename), file_number_(file_number), data_size_(0) {
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(filename_, ec);
+    std::string header;
+    if (!ec && size >= kHeaderSize && file_.open(filename_) && file_.read(0, kHeaderSize, header) &&
+        header == std::string_view(kBlobMagic, kHeaderSize)) {
+        data_size_ = size - kHeaderSize;
+    } else {
+        file_.close();
+    }
+}
+
+bool BlobFile::is_valid() const {
+    return file_.is_open();
+}
+
+const std::string& BlobFile::filename() const {
+    return filename_;
+}
+
+uint64_t BlobFile::file_number() const {
+    return file_number_;
+}
+
+uint64_t BlobFile::data_size() const {
+    return data_size_;
+}
+
+bool BlobFile::get(std::string_view key, const BlobIndex& index, std::string& value) const {
+    std::string record;
+    std::string_view record_key, record_value;
+    if (!read_raw(index, record) || !parse_record(record, record_key, record_value) ||
+        record_key != key) {
+        return false;
+    }
+    value.assign(record_value);
+    return true;
+}
+
+bool BlobFile::read_record(const BlobIndex& index, std::string& record) const {
+    std::string_view key, value;
+    return read_raw(index, record) && parse_record(record, key, value);
+}
+
+bool BlobFile::read_raw(const BlobIndex& index, std::string& record) const {
+    return is_valid() && index.file_number == file_number_ && index.offset >= kHeaderSize &&
+           index.size <= data_size_ && index.offset - kHeaderSize <= data_size_ - index.size &&
+           file_.read(index.offset, index.size, record);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <cstdint>
+#include "utils.hpp"
+
+// Where a value moved out of the LSM tree lives: the record of `size` bytes
+// at `offset` in blob file `file_number`. Tables store it in place of the
+// value, encoded as three varints.
+struct BlobIndex {
+    uint64_t file_number = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+
+    void encode_to(std::string& out) const;
+    bool decode_from(std::string_view in);
+};
+
+// Appends records to a new blob file. A blob file is the header "MKVBLOB1"
+// followed by records
+//   [checksum u32][key_len varint][value_len varint][key][value]
+// whose checksum covers everything after it, so a record can be copied to
+// another file as is. The file is only created by the first add().
+class BlobFileBuilder {
+public:
+    BlobFileBuilder(const std::string& filename, uint64_t file_number);
+    BlobFileBuilder(const BlobFileBuilder&) = delete;
+    BlobFileBuilder& operator=(const BlobFileBuilder&) = delete;
+
+    // Append a record and point index at it
+    bool add(std::string_view key, std::string_view value, BlobIndex& index);
+    // Append a record read from another blob file
+    bool add_record(std::string_view record, BlobIndex& index);
+    // Close the file; trivially true when nothing was added
+    bool finish();
+
+    bool empty() const;
+    const std::string& filename() const;
+    // Record bytes written, excluding the header
+    uint64_t data_size() const;
+
+private:
+    std::string filename_;
+    uint64_t file_number_;
+    std::ofstream file_;
+    uint64_t offset_;
+    std::string record_;  // scratch for add()
+};
+
+// Read side of a finished blob file. Safe to share between threads, and
+// reads keep working after the file is unlinked.
+class BlobFile {
+public:
+    BlobFile(const std::string& filename, uint64_t file_number);
+    BlobFile(const BlobFile&) = delete;
+    BlobFile& operator=(const BlobFile&) = delete;
+
+    bool is_valid() const;
+    const std::string& filename() const;
+    uint64_t file_number() const;
+    // Record bytes in the file, live or not, excluding the header
+    uint64_t data_size() const;
+
+    // Reads the value index points at; fails if the record is damaged or
+    // belongs to another key
+    bool get(std::string_view key, const BlobIndex& index, std::string& value) const;
+    // Reads the whole record index points at, checksum verified
+    bool read_record(const BlobIndex& index, std::string& record) const;
+
+private:
+    std::string filename_;
+    uint64_t file_number_;
+    uint64_t data_size_;
+    utils::RandomAccessFile file_;
+
+    bool read_raw(const BlobIndex& index, std::string& record) const;
+};
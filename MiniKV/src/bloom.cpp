@@ -0,0 +1,55 @@
+#include "bloom.hpp"
+#include "utils.hpp"
+#include <cstdint>
+
+namespace {
+
+uint32_t bloom_hash(const std::string& key) {
+    return utils::hash(key.data(), key.size(), 0xbc9f1d34);
+}
+
+}
+
+std::string BloomFilter::build(const std::vector<std::string>& keys, int bits_per_key) {
+    // k = ln(2) * bits_per_key minimises the false positive rate
+    size_t num_probes = static_cast<size_t>(bits_per_key * 0.69);
+    if (num_probes < 1) num_probes = 1;
+    if (num_probes > 30) num_probes = 30;
+
+    // Small key counts would otherwise give a very high false positive rate
+    size_t bits = keys.size() * bits_per_key;
+    if (bits < 64) bits = 64;
+    size_t bytes = (bits + 7) / 8;
+    bits = bytes * 8;
+
+    std::string filter(bytes, '\0');
+    for (const auto& key : keys) {
+        // Double hashing derives all probes from one hash value
+        uint32_t h = bloom_hash(key);
+        const uint32_t delta = (h >> 17) | (h << 15);
+        for (size_t j = 0; j < num_probes; ++j) {
+            const uint32_t bitpos = h % bits;
+            filter[bitpos / 8] |= static_cast<char>(1 << (bitpos % 8));
+            h += delta;
+        }
+    }
+    filter.push_back(static_cast<char>(num_probes));
+    return filter;
+}
+
+bool BloomFilter::may_contain(const std::string& filter, const std::string& key) {
+    if (filter.size() < 2) return true;
+
+    const size_t bits = (filter.size() - 1) * 8;
+    const size_t num_probes = static_cast<unsigned char>(filter.back());
+    if (num_probes > 30) return true;  // reserved for future encodings
+
+    uint32_t h = bloom_hash(key);
+    const uint32_t delta = (h >> 17) | (h << 15);
+    for (size_t j = 0; j < num_probes; ++j) {
+        const uint32_t bitpos = h % bits;
+        if ((filter[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
+        h += delta;
+    }
+    return true;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// LevelDB-style Bloom filter. The encoded filter is a bit array followed by
+// one byte holding the number of probes, so readers need no extra settings.
+class BloomFilter {
+public:
+    static std::string build(const std::vector<std::string>& keys, int bits_per_key);
+    static bool may_contain(const std::string& filter, const std::string& key);
+};
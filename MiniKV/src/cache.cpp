@@ -0,0 +1,88 @@
+#include "cache.hpp"
+#include "utils.hpp"
+
+BlockCache::BlockCache(size_t capacity_bytes, size_t num_shards)
+    : next_file_id_(0), hits_(0), misses_(0) {
+    if (num_shards == 0) num_shards = 1;
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+        shards_.back()->capacity = (capacity_bytes + num_shards - 1) / num_shards;
+    }
+}
+
+size_t BlockCache::KeyHash::operator()(const Key& key) const {
+    uint64_t parts[2] = {key.file_id, key.offset};
+    return utils::hash(reinterpret_cast<const char*>(parts), sizeof(parts), 0);
+}
+
+BlockCache::Shard& BlockCache::shard_for(const Key& key) {
+    return *shards_[KeyHash()(key) % shards_.size()];
+}
+
+BlockCache::Block BlockCache::lookup(uint64_t file_id, uint64_t offset) {
+    Key key{file_id, offset};
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.table.find(key);
+    if (it == shard.table.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // Move to the front of the LRU list
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return it->second->second;
+}
+
+void BlockCache::insert(uint64_t file_id, uint64_t offset, Block block) {
+    Key key{file_id, offset};
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.table.find(key);
+    if (it != shard.table.end()) {
+        shard.usage -= it->second->second->size();
+        shard.lru.erase(it->second);
+        shard.table.erase(it);
+    }
+
+    // Blocks larger than a whole shard are not worth caching
+    if (block->size() > shard.capacity) {
+        return;
+    }
+
+    shard.usage += block->size();
+    shard.lru.emplace_front(key, std::move(block));
+    shard.table[key] = shard.lru.begin();
+
+    // Evict least recently used blocks until we are back under budget
+    while (shard.usage > shard.capacity) {
+        auto& victim = shard.lru.back();
+        shard.usage -= victim.second->size();
+        shard.table.erase(victim.first);
+        shard.lru.pop_back();
+    }
+}
+
+uint64_t BlockCache::new_file_id() {
+    return next_file_id_.fetch_add(1) + 1;
+}
+
+size_t BlockCache::usage() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->usage;
+    }
+    return total;
+}
+
+uint64_t BlockCache::hits() const {
+    return hits_.load(std::memory_order_relaxed);
+}
+
+uint64_t BlockCache::misses() const {
+    return misses_.load(std::memory_order_relaxed);
+}
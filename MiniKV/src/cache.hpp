@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Sharded LRU cache of SSTable blocks, shared by every table of a KVStore.
+// Entries are keyed by (file id, block offset) and charged by block size.
+// Blocks are handed out as shared_ptrs, so eviction never invalidates a
+// block a reader is still using.
+class BlockCache {
+public:
+    using Block = std::shared_ptr<const std::string>;
+
+    explicit BlockCache(size_t capacity_bytes, size_t num_shards = 16);
+
+    Block lookup(uint64_t file_id, uint64_t offset);
+    void insert(uint64_t file_id, uint64_t offset, Block block);
+
+    // Ids for tables that share this cache
+    uint64_t new_file_id();
+
+    size_t usage() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Key {
+        uint64_t file_id;
+        uint64_t offset;
+        bool operator==(const Key& other) const {
+            return file_id == other.file_id && offset == other.offset;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        size_t capacity = 0;
+        size_t usage = 0;
+        std::list<std::pair<Key, Block>> lru;  // most recently used at the front
+        std::unordered_map<Key, std::list<std::pair<Key, Block>>::iterator, KeyHash> table;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint64_t> next_file_id_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+
+    Shard& shard_for(const Key& key);
+};
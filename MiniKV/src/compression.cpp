@@ -0,0 +1,171 @@
+#include "compression.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Compressed layout: [raw_len u32] then sequences of
+//   [token u8][literal_len ext][literals][offset u16][match_len ext]
+// The token holds the literal length in its high nibble and the match
+// length minus kMinMatch in its low one; a nibble of 15 continues in
+// extension bytes that are added up until one is below 255. The last
+// sequence stops after its literals.
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashBits = 14;
+
+uint32_t load32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+void put_length(std::string& out, size_t len) {
+    while (len >= 255) {
+        out.push_back(static_cast<char>(255));
+        len -= 255;
+    }
+    out.push_back(static_cast<char>(len));
+}
+
+bool get_length(const char*& p, const char* limit, size_t& len) {
+    uint8_t byte;
+    do {
+        if (p == limit) return false;
+        byte = static_cast<uint8_t>(*p++);
+        len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+void put_sequence(std::string& out, std::string_view literals, size_t offset, size_t match_len) {
+    size_t lit = literals.size();
+    size_t extra = match_len > 0 ? match_len - kMinMatch : 0;
+    uint8_t token = static_cast<uint8_t>((std::min<size_t>(lit, 15) << 4) | std::min<size_t>(extra, 15));
+    out.push_back(static_cast<char>(token));
+    if (lit >= 15) put_length(out, lit - 15);
+    out.append(literals.data(), literals.size());
+    if (match_len == 0) return;
+    uint16_t off = static_cast<uint16_t>(offset);
+    out.append(reinterpret_cast<const char*>(&off), sizeof(off));
+    if (extra >= 15) put_length(out, extra - 15);
+}
+
+// Lookups happen on every block read and write, so they only load an
+// atomic; the mutex just orders registrations, which own the codecs
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<const Compressor>> owned;
+    std::array<std::atomic<const Compressor*>, 256> codecs{};
+
+    Registry() {
+        owned.push_back(std::make_shared<LZCompressor>());
+        codecs[kLZCompression].store(owned.back().get(), std::memory_order_release);
+    }
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+}
+
+bool register_compressor(std::shared_ptr<const Compressor> compressor) {
+    if (!compressor || compressor->id() == kNoCompression) {
+        return false;
+    }
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto& slot = r.codecs[compressor->id()];
+    if (slot.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    r.owned.push_back(std::move(compressor));
+    slot.store(r.owned.back().get(), std::memory_order_release);
+    return true;
+}
+
+const Compressor* find_compressor(uint8_t id) {
+    // Codecs are never unregistered, so the pointer stays valid
+    return registry().codecs[id].load(std::memory_order_acquire);
+}
+
+void LZCompressor::compress(std::string_view input, std::string& output) const {
+    const char* in = input.data();
+    const size_t n = input.size();
+    uint32_t raw_len = static_cast<uint32_t>(n);
+    output.append(reinterpret_cast<const char*>(&raw_len), sizeof(raw_len));
+
+    // Positions are stored +1 so that 0 means empty
+    std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+    size_t anchor = 0;
+    size_t i = 0;
+    while (n >= kMinMatch && i + kMinMatch <= n) {
+        uint32_t seq = load32(in + i);
+        uint32_t& slot = table[hash32(seq)];
+        size_t candidate = slot;
+        slot = static_cast<uint32_t>(i + 1);
+        if (candidate == 0 || i - (candidate - 1) > kMaxOffset || load32(in + candidate - 1) != seq) {
+            ++i;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t len = kMinMatch;
+        while (i + len < n && in[match + len] == in[i + len]) {
+            ++len;
+        }
+        put_sequence(output, input.substr(anchor, i - anchor), i - match, len);
+        i += len;
+        anchor = i;
+    }
+    put_sequence(output, input.substr(anchor), 0, 0);
+}
+
+bool LZCompressor::decompress(std::string_view input, std::string& output) const {
+    const char* p = input.data();
+    const char* limit = p + input.size();
+    uint32_t raw_len;
+    if (input.size() < sizeof(raw_len)) return false;
+    std::memcpy(&raw_len, p, sizeof(raw_len));
+    p += sizeof(raw_len);
+
+    const size_t base = output.size();
+    // Each input byte yields at most ~255 output bytes; don't trust raw_len further
+    output.reserve(base + std::min<size_t>(raw_len, input.size() * 255));
+    while (p < limit) {
+        uint8_t token = static_cast<uint8_t>(*p++);
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(p, limit, lit)) return false;
+        if (static_cast<size_t>(limit - p) < lit || output.size() - base + lit > raw_len) return false;
+        output.append(p, lit);
+        p += lit;
+        if (p == limit) break;  // the last sequence has no match
+
+        uint16_t offset;
+        if (static_cast<size_t>(limit - p) < sizeof(offset)) return false;
+        std::memcpy(&offset, p, sizeof(offset));
+        p += sizeof(offset);
+        size_t len = token & 0x0f;
+        if (len == 15 && !get_length(p, limit, len)) return false;
+        len += kMinMatch;
+        size_t produced = output.size() - base;
+        if (offset == 0 || offset > produced || produced + len > raw_len) return false;
+
+        // Copies may overlap their own output, so go byte by byte
+        size_t from = output.size() - offset;
+        for (size_t k = 0; k < len; ++k) {
+            output.push_back(output[from + k]);
+        }
+    }
+    return output.size() - base == raw_len;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Codec ids stored in the trailer of every SSTable data block. Id 0 always
+// means the block is stored as is.
+constexpr uint8_t kNoCompression = 0;
+constexpr uint8_t kLZCompression = 1;
+
+// Block compression codec. Tables record the id of the codec each block was
+// written with, so readers need the same codec registered under that id.
+class Compressor {
+public:
+    virtual ~Compressor() = default;
+
+    virtual uint8_t id() const = 0;
+    virtual const char* name() const = 0;
+
+    // Appends the compressed form of input to output
+    virtual void compress(std::string_view input, std::string& output) const = 0;
+    // Appends the original bytes to output; false if input is corrupt
+    virtual bool decompress(std::string_view input, std::string& output) const = 0;
+};
+
+// Makes a codec available to readers and writers by its id. The built-in LZ
+// codec is always registered; ids already taken, and 0, are refused.
+bool register_compressor(std::shared_ptr<const Compressor> compressor);
+
+// nullptr when no codec has that id
+const Compressor* find_compressor(uint8_t id);
+
+// Byte-oriented LZ77 in the spirit of LZ4: a hash table of 4-byte sequences
+// finds matches within the last 64 KiB, and output alternates literal runs
+// and (offset, length) copies. Fast rather than tight.
+class LZCompressor : public Compressor {
+public:
+    uint8_t id() const override { return kLZCompression; }
+    const char* name() const override { return "lz"; }
+
+    void compress(std::string_view input, std::string& output) const override;
+    bool decompress(std::string_view input, std::string& output) const override;
+};
@@ -0,0 +1,281 @@
+#include "iterator.hpp"
+#include "memtable.hpp"
+#include "sstable.hpp"
+#include <algorithm>
+
+namespace {
+
+class MemTableIterator : public InternalIterator {
+public:
+    explicit MemTableIterator(std::shared_ptr<const MemTable> mem)
+        : mem_(std::move(mem)), iter_(mem_.get()) {}
+
+    void seek_to_first() override { iter_.seek_to_first(); }
+    void seek_to_last() override { iter_.seek_to_last(); }
+    void seek(const std::string& key) override { iter_.seek(key); }
+    bool valid() const override { return iter_.valid(); }
+    void next() override { iter_.next(); }
+    void prev() override { iter_.prev(); }
+
+    std::string_view key() const override { return iter_.key(); }
+    uint64_t sequence() const override { return iter_.sequence(); }
+    std::string_view value() const override { return iter_.value(); }
+    bool deleted() const override { return iter_.deleted(); }
+    bool is_blob_index() const override { return false; }
+
+private:
+    std::shared_ptr<const MemTable> mem_;
+    MemTable::Iterator iter_;
+};
+
+class TableIterator : public InternalIterator {
+public:
+    TableIterator(std::shared_ptr<SSTable> table, bool fill_cache)
+        : table_(std::move(table)), iter_(table_.get(), fill_cache) {}
+
+    void seek_to_first() override { iter_.seek_to_first(); }
+    void seek_to_last() override { iter_.seek_to_last(); }
+    void seek(const std::string& key) override { iter_.seek(key); }
+    bool valid() const override { return iter_.valid(); }
+    void next() override { iter_.next(); }
+    void prev() override { iter_.prev(); }
+
+    std::string_view key() const override { return iter_.key(); }
+    uint64_t sequence() const override { return iter_.sequence(); }
+    std::string_view value() const override { return iter_.value(); }
+    bool deleted() const override { return iter_.deleted(); }
+    bool is_blob_index() const override { return iter_.is_blob_index(); }
+
+private:
+    std::shared_ptr<SSTable> table_;
+    SSTable::Iterator iter_;
+};
+
+class LevelIterator : public InternalIterator {
+public:
+    LevelIterator(std::vector<std::shared_ptr<SSTable>> tables, bool fill_cache)
+        : tables_(std::move(tables)), fill_cache_(fill_cache), table_(0) {}
+
+    void seek_to_first() override {
+        if (open_table(0)) iter_->seek_to_first();
+        skip_forward();
+    }
+
+    void seek_to_last() override {
+        if (open_table(tables_.size() - 1)) iter_->seek_to_last();
+        skip_backward();
+    }
+
+    void seek(const std::string& key) override {
+        // The first table whose range ends at or after key
+        auto it = std::lower_bound(tables_.begin(), tables_.end(), key,
+            [](const std::shared_ptr<SSTable>& t, const std::string& k) { return t->largest_key() < k; });
+        if (open_table(it - tables_.begin())) iter_->seek(key);
+        skip_forward();
+    }
+
+    bool valid() const override { return iter_ && iter_->valid(); }
+
+    void next() override {
+        iter_->next();
+        skip_forward();
+    }
+
+    void prev() override {
+        iter_->prev();
+        skip_backward();
+    }
+
+    std::string_view key() const override { return iter_->key(); }
+    uint64_t sequence() const override { return iter_->sequence(); }
+    std::string_view value() const override { return iter_->value(); }
+    bool deleted() const override { return iter_->deleted(); }
+    bool is_blob_index() const override { return iter_->is_blob_index(); }
+
+private:
+    std::vector<std::shared_ptr<SSTable>> tables_;
+    bool fill_cache_;
+    size_t table_;
+    std::unique_ptr<SSTable::Iterator> iter_;
+
+    bool open_table(size_t table) {
+        if (table >= tables_.size()) {
+            iter_.reset();
+            return false;
+        }
+        table_ = table;
+        iter_ = std::make_unique<SSTable::Iterator>(tables_[table].get(), fill_cache_);
+        return true;
+    }
+
+    void skip_forward() {
+        while (iter_ && !iter_->valid()) {
+            if (open_table(table_ + 1)) iter_->seek_to_first();
+        }
+    }
+
+    void skip_backward() {
+        while (iter_ && !iter_->valid()) {
+            if (table_ > 0 && open_table(table_ - 1)) {
+                iter_->seek_to_last();
+            } else {
+                iter_.reset();
+            }
+        }
+    }
+};
+
+}
+
+std::unique_ptr<InternalIterator> new_memtable_iterator(std::shared_ptr<const MemTable> mem) {
+    return std::make_unique<MemTableIterator>(std::move(mem));
+}
+
+std::unique_ptr<InternalIterator> new_table_iterator(std::shared_ptr<SSTable> table, bool fill_cache) {
+    return std::make_unique<TableIterator>(std::move(table), fill_cache);
+}
+
+std::unique_ptr<InternalIterator> new_level_iterator(std::vector<std::shared_ptr<SSTable>> tables,
+                                                     bool fill_cache) {
+    return std::make_unique<LevelIterator>(std::move(tables), fill_cache);
+}
+
+MergingIterator::MergingIterator(std::vector<std::unique_ptr<InternalIterator>> children)
+    : children_(std::move(children)), forward_(true) {
+}
+
+int MergingIterator::compare(size_t child, std::string_view key, uint64_t sequence,
+                             size_t other) const {
+    // Forward order of child's entry against (key, sequence) from other
+    const auto& it = children_[child];
+    int cmp = it->key().compare(key);
+    if (cmp != 0) return cmp;
+    if (it->sequence() != sequence) return it->sequence() > sequence ? -1 : 1;
+    return child < other ? -1 : (child > other ? 1 : 0);
+}
+
+bool MergingIterator::before(size_t a, size_t b) const {
+    int cmp = compare(a, children_[b]->key(), children_[b]->sequence(), b);
+    return forward_ ? cmp < 0 : cmp > 0;
+}
+
+void MergingIterator::rebuild_heap(bool forward) {
+    forward_ = forward;
+    heap_.clear();
+    for (size_t i = 0; i < children_.size(); ++i) {
+        if (children_[i]->valid()) {
+            heap_.push_back(i);
+        }
+    }
+    std::make_heap(heap_.begin(), heap_.end(), [this](size_t a, size_t b) { return before(b, a); });
+}
+
+void MergingIterator::seek_to_first() {
+    for (auto& child : children_) {
+        child->seek_to_first();
+    }
+    rebuild_heap(true);
+}
+
+void MergingIterator::seek_to_last() {
+    for (auto& child : children_) {
+        child->seek_to_last();
+    }
+    rebuild_heap(false);
+}
+
+void MergingIterator::seek(const std::string& key) {
+    for (auto& child : children_) {
+        child->seek(key);
+    }
+    rebuild_heap(true);
+}
+
+bool MergingIterator::valid() const {
+    return !heap_.empty();
+}
+
+void MergingIterator::next() {
+    size_t current = heap_.front();
+    if (!forward_) {
+        // Turning around: move every other child to the first entry that
+        // follows the current one in forward order
+        std::string target(key());
+        uint64_t sequence = this->sequence();
+        for (size_t i = 0; i < children_.size(); ++i) {
+            if (i == current) continue;
+            auto& child = children_[i];
+            child->seek(target);
+            while (child->valid() && compare(i, target, sequence, current) < 0) {
+                child->next();
+            }
+        }
+        children_[current]->next();
+        rebuild_heap(true);
+        return;
+    }
+
+    auto cmp = [this](size_t a, size_t b) { return before(b, a); };
+    std::pop_heap(heap_.begin(), heap_.end(), cmp);
+    children_[current]->next();
+    if (children_[current]->valid()) {
+        std::push_heap(heap_.begin(), heap_.end(), cmp);
+    } else {
+        heap_.pop_back();
+    }
+}
+
+void MergingIterator::prev() {
+    size_t current = heap_.front();
+    if (forward_) {
+        // Turning around: move every other child to the last entry that
+        // precedes the current one in forward order
+        std::string target(key());
+        uint64_t sequence = this->sequence();
+        for (size_t i = 0; i < children_.size(); ++i) {
+            if (i == current) continue;
+            auto& child = children_[i];
+            child->seek(target);
+            while (child->valid() && compare(i, target, sequence, current) < 0) {
+                child->next();
+            }
+            if (child->valid()) {
+                child->prev();
+            } else {
+                child->seek_to_last();
+            }
+        }
+        children_[current]->prev();
+        rebuild_heap(false);
+        return;
+    }
+
+    auto cmp = [this](size_t a, size_t b) { return before(b, a); };
+    std::pop_heap(heap_.begin(), heap_.end(), cmp);
+    children_[current]->prev();
+    if (children_[current]->valid()) {
+        std::push_heap(heap_.begin(), heap_.end(), cmp);
+    } else {
+        heap_.pop_back();
+    }
+}
+
+std::string_view MergingIterator::key() const {
+    return children_[heap_.front()]->key();
+}
+
+uint64_t MergingIterator::sequence() const {
+    return children_[heap_.front()]->sequence();
+}
+
+std::string_view MergingIterator::value() const {
+    return children_[heap_.front()]->value();
+}
+
+bool MergingIterator::deleted() const {
+    return children_[heap_.front()]->deleted();
+}
+
+bool MergingIterator::is_blob_index() const {
+    return children_[heap_.front()]->is_blob_index();
+}
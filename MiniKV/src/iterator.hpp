@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+class MemTable;
+class SSTable;
+
+// Sorted stream of entries from one layer of the store, tombstones included.
+// Entries are ordered by key, then by sequence newest first. Scans and
+// compactions stack these: leaves walk a memtable or SSTables, a
+// MergingIterator combines them, and KVStore::Iterator hides old versions.
+// key() and value() stay valid until the iterator moves.
+class InternalIterator {
+public:
+    virtual ~InternalIterator() = default;
+
+    virtual void seek_to_first() = 0;
+    virtual void seek_to_last() = 0;
+    // Positions at the newest version of the first key >= key
+    virtual void seek(const std::string& key) = 0;
+    virtual bool valid() const = 0;
+    virtual void next() = 0;
+    virtual void prev() = 0;
+
+    virtual std::string_view key() const = 0;
+    virtual uint64_t sequence() const = 0;
+    virtual std::string_view value() const = 0;
+    virtual bool deleted() const = 0;
+    // value() is an encoded BlobIndex rather than the value itself
+    virtual bool is_blob_index() const = 0;
+};
+
+// Walks a memtable, keeping it alive for as long as the iterator lives
+std::unique_ptr<InternalIterator> new_memtable_iterator(std::shared_ptr<const MemTable> mem);
+
+// Walks one SSTable, keeping it open for as long as the iterator lives
+std::unique_ptr<InternalIterator> new_table_iterator(std::shared_ptr<SSTable> table,
+                                                     bool fill_cache = true);
+
+// Walks a level of tables with disjoint key ranges, sorted by smallest key,
+// opening one table at a time
+std::unique_ptr<InternalIterator> new_level_iterator(std::vector<std::shared_ptr<SSTable>> tables,
+                                                     bool fill_cache = true);
+
+// K-way merge over a heap of children. Entries are merged by key and then
+// sequence; children are listed newest first, which only breaks ties between
+// tables written before sequences existed.
+class MergingIterator : public InternalIterator {
+public:
+    explicit MergingIterator(std::vector<std::unique_ptr<InternalIterator>> children);
+
+    void seek_to_first() override;
+    void seek_to_last() override;
+    void seek(const std::string& key) override;
+    bool valid() const override;
+    void next() override;
+    void prev() override;
+
+    std::string_view key() const override;
+    uint64_t sequence() const override;
+    std::string_view value() const override;
+    bool deleted() const override;
+    bool is_blob_index() const override;
+
+private:
+    std::vector<std::unique_ptr<InternalIterator>> children_;
+    std::vector<size_t> heap_;  // valid children; the current one is heap_.front()
+    bool forward_;
+
+    int compare(size_t child, std::string_view key, uint64_t sequence, size_t other) const;
+    bool before(size_t a, size_t b) const;
+    void rebuild_heap(bool forward);
+};
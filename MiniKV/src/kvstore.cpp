@@ -1,21 +1,163 @@
 #include "kvstore.hpp"
 #include "wal.hpp"
+#include "write_batch.hpp"
+#include "memtable.hpp"
 #include "sstable.hpp"
+#include "blob.hpp"
+#include "lsm.hpp"
+#include "iterator.hpp"
+#include "cache.hpp"
 #include "utils.hpp"
 #include <filesystem>
 #include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <atomic>
+#include <thread>
 
-KVStore::KVStore(const std::string& data_dir)
-    : data_dir_(data_dir), memtable_size_limit_(1024 * 1024), current_memtable_size_(0) {
+namespace {
+
+// Applies a logged operation as `sequence`; a batch's operations take
+// consecutive numbers from there. Returns the last number used. Entry is a
+// WAL::LogEntry or a WAL::EntryView.
+template <typename Entry>
+uint64_t apply_entry(MemTable& mem, const Entry& entry, uint64_t sequence) {
+    if (entry.op_type == WAL::OpType::PUT) {
+        mem.put(entry.key, entry.value, sequence);
+    } else if (entry.op_type == WAL::OpType::DELETE) {
+        mem.remove(entry.key, sequence);
+    } else if (entry.op_type == WAL::OpType::BATCH && !entry.batch.empty()) {
+        for (const auto& op : entry.batch) {
+            apply_entry(mem, op, sequence++);
+        }
+        return sequence - 1;
+    }
+    return sequence;
+}
+
+// Reads the value an encoded BlobIndex points at
+bool read_blob(const std::map<uint64_t, std::shared_ptr<BlobFile>>& blobs, std::string_view key,
+               std::string_view index, std::string& value) {
+    BlobIndex blob;
+    if (!blob.decode_from(index)) {
+        return false;
+    }
+    auto it = blobs.find(blob.file_number);
+    return it != blobs.end() && it->second->get(key, blob, value);
+}
+
+// Smallest key greater than every key starting with prefix; empty if none
+std::string prefix_successor(std::string prefix) {
+    while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xff) {
+        prefix.pop_back();
+    }
+    if (!prefix.empty()) {
+        prefix.back() = static_cast<char>(prefix.back() + 1);
+    }
+    return prefix;
+}
+
+// Parses names like "sstable_12.sst" or "wal_7.log"
+bool parse_file_number(const std::string& name, const std::string& prefix,
+                       const std::string& suffix, uint64_t& number) {
+    if (name.size() <= prefix.size() + suffix.size() ||
+        name.compare(0, prefix.size(), prefix) != 0 ||
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return false;
+    }
+    std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+    if (!std::all_of(digits.begin(), digits.end(), ::isdigit)) {
+        return false;
+    }
+    number = std::stoull(digits);
+    return true;
+}
+
+// Largest number of a log segment in dir, retired ones included
+uint64_t max_log_number(const std::string& dir) {
+    uint64_t max_number = 0;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        uint64_t number;
+        if (parse_file_number(name, "wal_", ".log", number) ||
+            parse_file_number(name, "wal_", ".log.recycle", number)) {
+            max_number = std::max(max_number, number);
+        }
+    }
+    return max_number;
+}
+
+// Runs fn(i) for every i below n on up to max_threads threads, the calling
+// one included; 0 means one per core
+template <typename Fn>
+void parallel_for(size_t n, int max_threads, const Fn& fn) {
+    size_t limit = max_threads > 0 ? max_threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t num_threads = std::min(n, limit);
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i = next++; i < n; i = next++) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// What the manifest records of a table
+FileMetaData describe_table(const SSTable& table, int level) {
+    FileMetaData file;
+    parse_file_number(std::filesystem::path(table.filename()).filename().string(), "sstable_", ".sst",
+                      file.number);
+    file.level = level;
+    file.file_size = table.file_size();
+    file.smallest_key = table.smallest_key();
+    file.largest_key = table.largest_key();
+    file.largest_sequence = table.largest_sequence();
+    return file;
+}
+
+}
+
+KVStore::KVStore(const std::string& data_dir, const Options& options)
+    : data_dir_(data_dir), options_(options), mem_(nullptr),
+      stats_(nullptr), visible_sequence_(0), snapshots_(std::make_shared<SnapshotList>()),
+      shutting_down_(false), bg_error_(false), manual_level_(-1), manual_end_(0),
+      next_file_number_(0), memtable_size_limit_(options.memtable_size_limit) {
+
+    mem_ = new_memtable();
+    options_.num_levels = std::max(options_.num_levels, 2);
+    levels_ = std::make_shared<const Levels>(options_.num_levels);
+    blob_files_ = std::make_shared<const BlobFiles>();
+    compact_pointer_.resize(options_.num_levels);
+
+    // One block cache shared by every SSTable of this store
+    if (!options_.block_cache && options_.block_cache_size > 0) {
+        options_.block_cache = std::make_shared<BlockCache>(options_.block_cache_size);
+    }
+    if (!options_.statistics) {
+        options_.statistics = std::make_shared<Statistics>();
+    }
+    stats_ = options_.statistics.get();
 
     // Create data directory if it doesn't exist
     std::filesystem::create_directories(data_dir_);
 
-    // Initialize WAL
-    wal_ = std::make_unique<WAL>(data_dir_ + "/wal.log");
-
-    // Recover from existing data
+    // Recover from existing data, then log to a fresh WAL segment
     recover();
+    size_t segment_size = options_.wal_segment_size > 0 ? options_.wal_segment_size : memtable_size_limit_;
+    wal_ = std::make_unique<WAL>(log_filename(++next_file_number_), visible_sequence_.load(), stats_,
+                                 segment_size);
+
+    flush_thread_ = std::thread(&KVStore::background_flush, this);
+    compaction_thread_ = std::thread(&KVStore::background_compaction, this);
 }
 
 KVStore::~KVStore() {
@@ -23,132 +165,1425 @@ KVStore::~KVStore() {
 }
 
 bool KVStore::put(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    StopWatch timer(stats_, Histogram::PUT);
+    if (!make_room_for_write()) {
+        return false;
+    }
+
+    // Write to WAL first for durability; the commit group leader applies
+    // the memtable update in log order once the record is on disk. mem_ is
+    // only swapped inside run_exclusive, so the leader needs no lock.
+    bool ok = wal_->write_put(key, value, [&](uint64_t sequence) {
+        mem_->put(key, value, sequence);
+        visible_sequence_.store(sequence, std::memory_order_release);
+    });
+    if (ok) {
+        stats_->record_tick(Ticker::BYTES_WRITTEN, key.size() + value.size());
+    }
+    return ok;
+}
+
+bool KVStore::get(const std::string& key, std::string& value, const ReadOptions& options) {
+    StopWatch timer(stats_, Histogram::GET);
+    bool found = lookup(key, value, options);
+    if (found) {
+        stats_->record_tick(Ticker::GET_HIT);
+        stats_->record_tick(Ticker::BYTES_READ, key.size() + value.size());
+    } else {
+        stats_->record_tick(Ticker::GET_MISS);
+    }
+    return found;
+}
+
+bool KVStore::lookup(const std::string& key, std::string& value, const ReadOptions& options) {
+    // Pin the current memtables and tables, then search without the lock.
+    // Anything up to the read sequence is in what gets pinned after it.
+    uint64_t sequence;
+    std::shared_ptr<const MemTable> mem, imm;
+    std::shared_ptr<const Levels> levels;
+    std::shared_ptr<const BlobFiles> blobs;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sequence = read_sequence(options);
+        mem = mem_;
+        imm = imm_;
+        levels = levels_;
+        blobs = blob_files_;
+    }
+
+    // Check memtables first: the active one, then the one being flushed
+    for (const MemTable* memtable : {mem.get(), imm.get()}) {
+        if (!memtable) continue;
+        auto result = memtable->get(key, value, sequence);
+        if (result != LookupResult::NOT_FOUND) {
+            stats_->record_tick(Ticker::MEMTABLE_HIT);
+            return result == LookupResult::FOUND;
+        }
+    }
+    stats_->record_tick(Ticker::MEMTABLE_MISS);
+
+    // L0 tables may overlap, so check them most recent first; a tombstone
+    // hides older values
+    uint64_t probes = 0;
+    auto result = LookupResult::NOT_FOUND;
+    const auto& level0 = (*levels)[0];
+    for (auto rit = level0.rbegin(); rit != level0.rend() && result == LookupResult::NOT_FOUND; ++rit) {
+        result = (*rit)->lookup(key, value, sequence);
+        probes++;
+    }
+
+    // Deeper levels are disjoint: at most one table per level holds the key
+    for (size_t level = 1; level < levels->size() && result == LookupResult::NOT_FOUND; ++level) {
+        TablePtr table = find_table((*levels)[level], key);
+        if (!table) continue;
+        result = table->lookup(key, value, sequence);
+        probes++;
+    }
+
+    stats_->record_tick(Ticker::SSTABLE_PROBES, probes);
+    if (result == LookupResult::BLOB_INDEX) {
+        std::string index = std::move(value);
+        if (!read_blob(*blobs, key, index, value)) {
+            return false;
+        }
+        stats_->record_tick(Ticker::BLOB_BYTES_READ, value.size());
+        return true;
+    }
+    return result == LookupResult::FOUND;
+}
+
+std::vector<std::optional<std::string>> KVStore::multi_get(const std::vector<std::string>& keys,
+                                                           const ReadOptions& options) {
+    StopWatch timer(stats_, Histogram::MULTI_GET);
+    uint64_t sequence;
+    std::shared_ptr<const MemTable> mem, imm;
+    std::shared_ptr<const Levels> levels;
+    std::shared_ptr<const BlobFiles> blobs;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sequence = read_sequence(options);
+        mem = mem_;
+        imm = imm_;
+        levels = levels_;
+        blobs = blob_files_;
+    }
+
+    // Keys are resolved in the same order get searches, with the ones
+    // still unresolved kept in key order
+    std::vector<LookupResult> results(keys.size(), LookupResult::NOT_FOUND);
+    std::vector<std::string> values(keys.size());
+    std::vector<size_t> pending(keys.size());
+    std::iota(pending.begin(), pending.end(), 0);
+    std::stable_sort(pending.begin(), pending.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    for (const MemTable* memtable : {mem.get(), imm.get()}) {
+        if (!memtable) continue;
+        std::vector<size_t> rest;
+        for (size_t i : pending) {
+            results[i] = memtable->get(keys[i], values[i], sequence);
+            if (results[i] == LookupResult::NOT_FOUND) rest.push_back(i);
+        }
+        pending = std::move(rest);
+    }
+    stats_->record_tick(Ticker::MEMTABLE_HIT, keys.size() - pending.size());
+    stats_->record_tick(Ticker::MEMTABLE_MISS, pending.size());
+
+    // Passes the pending keys over tables sorted by key with disjoint
+    // ranges; each table is searched once, for the run of keys in its range
+    uint64_t probes = 0;
+    std::vector<const std::string*> batch;
+    std::vector<LookupResult> batch_results;
+    std::vector<std::string> batch_values;
+    auto search = [&](const TablePtr* tables, size_t num_tables) {
+        std::vector<size_t> rest;
+        size_t t = 0;
+        for (size_t p = 0; p < pending.size();) {
+            const std::string& key = keys[pending[p]];
+            while (t < num_tables && tables[t]->largest_key() < key) ++t;
+            if (t == num_tables || key < tables[t]->smallest_key()) {
+                rest.push_back(pending[p++]);
+                continue;
+            }
+            batch.clear();
+            size_t first = p;
+            for (; p < pending.size() && keys[pending[p]] <= tables[t]->largest_key(); ++p) {
+                batch.push_back(&keys[pending[p]]);
+            }
+            tables[t]->multi_lookup(batch, sequence, batch_results, batch_values);
+            probes += batch.size();
+            for (size_t j = 0; j < batch.size(); ++j) {
+                size_t i = pending[first + j];
+                if (batch_results[j] == LookupResult::NOT_FOUND) {
+                    rest.push_back(i);
+                } else {
+                    results[i] = batch_results[j];
+                    values[i] = std::move(batch_values[j]);
+                }
+            }
+        }
+        pending = std::move(rest);
+    };
+
+    // L0 tables one at a time, most recent first, then each deeper level
+    // as a whole
+    const auto& level0 = (*levels)[0];
+    for (auto rit = level0.rbegin(); rit != level0.rend() && !pending.empty(); ++rit) {
+        search(&*rit, 1);
+    }
+    for (size_t level = 1; level < levels->size() && !pending.empty(); ++level) {
+        search((*levels)[level].data(), (*levels)[level].size());
+    }
+    stats_->record_tick(Ticker::SSTABLE_PROBES, probes);
+
+    std::vector<std::optional<std::string>> found(keys.size());
+    uint64_t hits = 0, bytes_read = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (results[i] == LookupResult::BLOB_INDEX) {
+            std::string value;
+            if (!read_blob(*blobs, keys[i], values[i], value)) continue;
+            stats_->record_tick(Ticker::BLOB_BYTES_READ, value.size());
+            found[i] = std::move(value);
+        } else if (results[i] == LookupResult::FOUND) {
+            found[i] = std::move(values[i]);
+        } else {
+            continue;
+        }
+        hits++;
+        bytes_read += keys[i].size() + found[i]->size();
+    }
+    stats_->record_tick(Ticker::GET_HIT, hits);
+    stats_->record_tick(Ticker::GET_MISS, keys.size() - hits);
+    stats_->record_tick(Ticker::BYTES_READ, bytes_read);
+    return found;
+}
+
+std::unique_ptr<KVStore::Iterator> KVStore::new_iterator(const ReadOptions& options) {
+    std::vector<std::unique_ptr<InternalIterator>> sources;
+    std::shared_ptr<const BlobFiles> blobs;
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blobs = blob_files_;
+
+        // Sources newest first. Writes landing in the active memtable during
+        // the scan carry later sequences, which the iterator skips.
+        sequence = read_sequence(options);
+        sources.push_back(new_memtable_iterator(mem_));
+        if (imm_) {
+            sources.push_back(new_memtable_iterator(imm_));
+        }
+        const Levels& levels = *levels_;
+        for (auto rit = levels[0].rbegin(); rit != levels[0].rend(); ++rit) {
+            sources.push_back(new_table_iterator(*rit, options.fill_cache));
+        }
+        for (size_t level = 1; level < levels.size(); ++level) {
+            if (!levels[level].empty()) {
+                sources.push_back(new_level_iterator(levels[level], options.fill_cache));
+            }
+        }
+    }
+
+    auto merged = std::make_unique<MergingIterator>(std::move(sources));
+    return std::unique_ptr<Iterator>(new Iterator(std::move(merged), std::move(blobs), options, sequence));
+}
+
+uint64_t KVStore::read_sequence(const ReadOptions& options) const {
+    return options.snapshot ? options.snapshot->sequence()
+                            : visible_sequence_.load(std::memory_order_acquire);
+}
+
+KVStore::Iterator::Iterator(std::unique_ptr<InternalIterator> iter, std::shared_ptr<const BlobFiles> blobs,
+                            const ReadOptions& options, uint64_t sequence)
+    : iter_(std::move(iter)), blobs_(std::move(blobs)), sequence_(sequence), lower_(options.prefix),
+      upper_(options.upper_bound), forward_(true), valid_(false), blob_(false) {
+    // A prefix also bounds the scan from above, by the first key past it
+    std::string limit = prefix_successor(options.prefix);
+    if (!limit.empty() && (upper_.empty() || limit < upper_)) {
+        upper_ = limit;
+    }
+}
+
+KVStore::Iterator::~Iterator() = default;
+
+void KVStore::Iterator::seek_to_first() {
+    seek(lower_);
+}
 
-    // Write to WAL first for durability
-    if (!wal_->write_put(key, value)) {
+void KVStore::Iterator::seek_to_last() {
+    if (upper_.empty()) {
+        iter_->seek_to_last();
+    } else {
+        iter_->seek(upper_);
+        if (iter_->valid()) {
+            iter_->prev();
+        } else {
+            iter_->seek_to_last();
+        }
+    }
+    forward_ = false;
+    find_prev_visible();
+}
+
+void KVStore::Iterator::seek(const std::string& key) {
+    iter_->seek(std::max(key, lower_));
+    forward_ = true;
+    find_next_visible(false);
+}
+
+bool KVStore::Iterator::valid() const {
+    return valid_;
+}
+
+void KVStore::Iterator::next() {
+    if (forward_) {
+        saved_key_.assign(iter_->key());
+    } else {
+        // Turning around: saved_key_ is the current key, skip up to it
+        iter_->seek(saved_key_);
+        forward_ = true;
+    }
+    find_next_visible(true);
+}
+
+void KVStore::Iterator::prev() {
+    if (forward_) {
+        // Back up past every version of the current key
+        saved_key_.assign(iter_->key());
+        do {
+            iter_->prev();
+        } while (iter_->valid() && iter_->key() >= saved_key_);
+        forward_ = false;
+    }
+    find_prev_visible();
+}
+
+std::string_view KVStore::Iterator::key() const {
+    return forward_ ? iter_->key() : std::string_view(saved_key_);
+}
+
+std::string_view KVStore::Iterator::value() const {
+    return forward_ && !blob_ ? iter_->value() : std::string_view(saved_value_);
+}
+
+void KVStore::Iterator::find_next_visible(bool skipping) {
+    // Versions of a key arrive newest first; with skipping set, everything
+    // up to saved_key_ has been handled already
+    for (; iter_->valid(); iter_->next()) {
+        std::string_view key = iter_->key();
+        if (!upper_.empty() && key >= upper_) {
+            break;
+        }
+        if (iter_->sequence() > sequence_) {
+            continue;
+        }
+        if (skipping && key <= saved_key_) {
+            continue;
+        }
+        if (iter_->deleted()) {
+            saved_key_.assign(key);
+            skipping = true;
+            continue;
+        }
+        valid_ = true;
+        blob_ = iter_->is_blob_index();
+        if (blob_) {
+            saved_value_.clear();
+            read_blob(*blobs_, key, iter_->value(), saved_value_);
+        }
+        return;
+    }
+    valid_ = false;
+}
+
+void KVStore::Iterator::find_prev_visible() {
+    // Going backward versions arrive oldest first, so a key is settled only
+    // once a smaller key shows up
+    bool found = false;
+    bool blob = false;
+    for (; iter_->valid(); iter_->prev()) {
+        std::string_view key = iter_->key();
+        if (key < lower_ || (found && key < saved_key_)) {
+            break;
+        }
+        if (iter_->sequence() > sequence_) {
+            continue;
+        }
+        found = !iter_->deleted();
+        if (found) {
+            saved_key_.assign(key);
+            saved_value_.assign(iter_->value());
+            blob = iter_->is_blob_index();
+        }
+    }
+    if (found && blob) {
+        std::string index = std::move(saved_value_);
+        saved_value_.clear();
+        read_blob(*blobs_, saved_key_, index, saved_value_);
+    }
+    valid_ = found;
+}
+
+KVStore::TablePtr KVStore::find_table(const std::vector<TablePtr>& level, const std::string& key) {
+    auto it = std::lower_bound(level.begin(), level.end(), key,
+        [](const TablePtr& table, const std::string& k) { return table->largest_key() < k; });
+    if (it == level.end() || key < (*it)->smallest_key()) {
+        return nullptr;
+    }
+    return *it;
+}
+
+bool KVStore::remove(const std::string& key) {
+    StopWatch timer(stats_, Histogram::REMOVE);
+    if (!make_room_for_write()) {
         return false;
     }
 
-    // Update memtable
-    auto old_size = memtable_[key].size();
-    memtable_[key] = value;
-    current_memtable_size_ += value.size() + key.size() - old_size;
+    // Write to WAL, then record a tombstone that shadows older values
+    bool ok = wal_->write_delete(key, [&](uint64_t sequence) {
+        mem_->remove(key, sequence);
+        visible_sequence_.store(sequence, std::memory_order_release);
+    });
+    if (ok) {
+        stats_->record_tick(Ticker::BYTES_WRITTEN, key.size());
+    }
+    return ok;
+}
 
-    // Check if memtable needs flushing
-    if (current_memtable_size_ > memtable_size_limit_) {
-        flush_to_sstable();
+bool KVStore::write(const WriteBatch& batch) {
+    if (batch.empty()) {
+        return true;
+    }
+    StopWatch timer(stats_, Histogram::WRITE);
+    if (!make_room_for_write()) {
+        return false;
     }
 
-    return true;
+    // One WAL record and one lock acquisition for the whole batch
+    bool ok = wal_->write_batch(batch, [&](uint64_t sequence) {
+        for (const auto& entry : batch.entries()) {
+            apply_entry(*mem_, entry, sequence++);
+        }
+        visible_sequence_.store(sequence - 1, std::memory_order_release);
+    });
+    if (ok) {
+        uint64_t bytes = 0;
+        for (const auto& entry : batch.entries()) {
+            bytes += entry.key.size() + entry.value.size();
+        }
+        stats_->record_tick(Ticker::BYTES_WRITTEN, bytes);
+    }
+    return ok;
 }
 
-bool KVStore::get(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
+void KVStore::recover() {
+    manifest_ = std::make_unique<Manifest>(data_dir_ + "/MANIFEST");
+    if (manifest_->recover()) {
+        if (!load_manifest_tables()) {
+            // Serve reads from the tables that did open, but change nothing
+            // on disk: the missing ones are still live, and so is the log.
+            // The new log is numbered past every segment, so it never
+            // reopens one that wasn't replayed.
+            bg_error_ = true;
+            next_file_number_ = std::max(next_file_number_, max_log_number(data_dir_));
+            update_blob_files();
+            return;
+        }
+    } else {
+        load_existing_sstables();
+    }
+
+    // Start a new log holding just the live set; replayed segments are
+    // recorded in it before they go
+    if (!save_manifest()) {
+        std::cerr << "MiniKV: failed to write " << data_dir_ << "/MANIFEST\n";
+        bg_error_ = true;
+    }
+    if (!replay_wal()) {
+        // Reads would miss whatever the log holds; refuse writes until a
+        // reopen replays it
+        std::cerr << "MiniKV: failed to recover the log in " << data_dir_ << "\n";
+        bg_error_ = true;
+    }
+    update_blob_files();
+    remove_obsolete_files();
+}
+
+bool KVStore::load_manifest_tables() {
+    next_file_number_ = std::max(next_file_number_, manifest_->next_file_number());
+    std::vector<const FileMetaData*> files;
+    for (const auto& [number, file] : manifest_->files()) {
+        next_file_number_ = std::max(next_file_number_, number);
+        files.push_back(&file);
+    }
+
+    // Opening a table reads its index and filter, so tables are opened
+    // several at a time
+    std::vector<TablePtr> tables(files.size());
+    parallel_for(files.size(), options_.max_open_threads, [&](size_t i) {
+        tables[i] = std::make_shared<SSTable>(sstable_filename(files[i]->number), options_);
+    });
+
+    bool ok = true;
+    auto levels = std::make_shared<Levels>(options_.num_levels);
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!tables[i]->is_valid()) {
+            std::cerr << "MiniKV: can't open " << tables[i]->filename() << ", listed in the manifest\n";
+            ok = false;
+            continue;
+        }
+        visible_sequence_.store(std::max(visible_sequence_.load(), files[i]->largest_sequence));
+        int level = std::min(files[i]->level, options_.num_levels - 1);
+        (*levels)[level].push_back(std::move(tables[i]));
+    }
+
+    // L0 stays in number order, which is the order it was written in
+    for (size_t level = 1; level < levels->size(); ++level) {
+        std::sort((*levels)[level].begin(), (*levels)[level].end(), [](const TablePtr& a, const TablePtr& b) {
+            return a->smallest_key() < b->smallest_key();
+        });
+    }
+    levels_ = std::move(levels);
+    return ok;
+}
+
+void KVStore::remove_obsolete_files() {
+    // Left by a flush, compaction or garbage collection that never made it
+    // into the manifest
+    std::set<uint64_t> live;
+    for (const auto& level : *levels_) {
+        for (const auto& table : level) {
+            live.insert(describe_table(*table, 0).number);
+        }
+    }
+    std::vector<std::filesystem::path> obsolete;
+    for (const auto& entry : std::filesystem::directory_iterator(data_dir_)) {
+        std::string name = entry.path().filename().string();
+        uint64_t number = 0;
+        if (entry.path().extension() == ".tmp") {
+            obsolete.push_back(entry.path());
+        } else if (parse_file_number(name, "sstable_", ".sst", number)) {
+            if (!live.count(number)) obsolete.push_back(entry.path());
+        } else if (parse_file_number(name, "blob_", ".blob", number)) {
+            if (!blob_files_->count(number)) obsolete.push_back(entry.path());
+        } else {
+            continue;
+        }
+        // Never reuse a number, even one about to be deleted
+        next_file_number_ = std::max(next_file_number_, number);
+    }
+    for (const auto& path : obsolete) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+}
+
+bool KVStore::replay_wal() {
+    // Leftover segments are replayed oldest first; wal.log predates numbering.
+    // Retired segments are only picked up for reuse.
+    std::vector<std::pair<uint64_t, std::string>> logs;
+    std::vector<std::string> recycled;
+    for (const auto& entry : std::filesystem::directory_iterator(data_dir_)) {
+        std::string name = entry.path().filename().string();
+        uint64_t number;
+        if (entry.path().extension() == ".recycle") {
+            recycled.push_back(entry.path().string());
+        } else if (name == "wal.log") {
+            logs.push_back({0, entry.path().string()});
+        } else if (parse_file_number(name, "wal_", ".log", number)) {
+            logs.push_back({number, entry.path().string()});
+            next_file_number_ = std::max(next_file_number_, number);
+        }
+    }
+    std::sort(logs.begin(), logs.end());
+    for (const auto& path : recycled) {
+        retire_log(path);
+    }
 
-    // Check memtable first
-    auto it = memtable_.find(key);
-    if (it != memtable_.end()) {
-        value = it->second;
+    if (logs.empty()) {
         return true;
     }
 
-    // Check SSTables (most recent first)
-    for (auto rit = sstables_.rbegin(); rit != sstables_.rend(); ++rit) {
-        if ((*rit)->get(key, value)) {
+    // Every segment holds the writes of one memtable, and its records carry
+    // their own sequence numbers, so segments replay independently: each
+    // is streamed from its mapping into a memtable of its own and written
+    // out as an L0 table, several at a time. Records from before sequencing
+    // are numbered after everything else, so segments holding them are
+    // redone afterwards into one more table. Table numbers follow log order,
+    // which is the order L0 is searched in.
+    struct Segment {
+        TablePtr table;
+        uint64_t last_sequence = 0;
+        bool legacy = false;
+        bool ok = true;
+    };
+    std::vector<Segment> segments(logs.size() + 1);  // the last one collects legacy records
+    uint64_t first_number = next_file_number_ + 1;
+    next_file_number_ += segments.size();
+
+    auto replay_segment = [&](size_t i) {
+        Segment& segment = segments[i];
+        auto mem = new_memtable();
+        WAL::replay_file(logs[i].second, [&](const WAL::EntryView& entry) {
+            if (entry.sequence == 0) {
+                segment.legacy = true;
+                return false;
+            }
+            segment.last_sequence = std::max(segment.last_sequence,
+                                             apply_entry(*mem, entry, entry.sequence));
             return true;
+        });
+        if (!segment.legacy && !mem->empty()) {
+            segment.table = build_table(*mem, first_number + i);
+            segment.ok = segment.table != nullptr;
         }
+    };
+
+    parallel_for(logs.size(), options_.max_open_threads, replay_segment);
+
+    uint64_t last_sequence = visible_sequence_.load();
+    for (const Segment& segment : segments) {
+        last_sequence = std::max(last_sequence, segment.last_sequence);
+    }
+    auto legacy_mem = new_memtable();
+    for (size_t i = 0; i < logs.size(); ++i) {
+        if (!segments[i].legacy) continue;
+        WAL::replay_file(logs[i].second, [&](const WAL::EntryView& entry) {
+            uint64_t sequence = entry.sequence != 0 ? entry.sequence : last_sequence + 1;
+            last_sequence = std::max(last_sequence, apply_entry(*legacy_mem, entry, sequence));
+            return true;
+        });
+    }
+    if (!legacy_mem->empty()) {
+        segments.back().table = build_table(*legacy_mem, first_number + logs.size());
+        segments.back().ok = segments.back().table != nullptr;
     }
 
-    return false;
+    // Persist what was recovered so the old segments can go
+    bool ok = std::all_of(segments.begin(), segments.end(), [](const Segment& s) { return s.ok; });
+    if (!ok) {
+        // Keep the segments; they are replayed again next time
+        for (const Segment& segment : segments) {
+            if (!segment.table) continue;
+            std::error_code ec;
+            std::filesystem::remove(segment.table->filename(), ec);
+        }
+        return false;
+    }
+    VersionEdit edit;
+    auto levels = std::make_shared<Levels>(*levels_);
+    for (Segment& segment : segments) {
+        if (segment.table) {
+            edit.added.push_back(describe_table(*segment.table, 0));
+            (*levels)[0].push_back(std::move(segment.table));
+        }
+    }
+    if (!log_edit(edit)) {
+        return false;  // the tables are removed as obsolete; the segments stay
+    }
+    levels_ = std::move(levels);
+    visible_sequence_.store(last_sequence);
+    for (const auto& [number, path] : logs) {
+        retire_log(path);
+    }
+    return true;
 }
 
-bool KVStore::remove(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
+bool KVStore::make_room_for_write() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (bg_error_) {
+            return false;
+        }
+        if (mem_->approximate_size() <= memtable_size_limit_) {
+            return true;
+        }
+    }
 
-    // Write to WAL
-    if (!wal_->write_delete(key)) {
+    // Switch between commit groups so every logged record lands in the
+    // memtable that belongs to its segment
+    bool ok = true;
+    wal_->run_exclusive([&] {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (mem_->approximate_size() > memtable_size_limit_) {
+            ok = switch_memtable(lock);
+        }
+    });
+    return ok;
+}
+
+bool KVStore::switch_memtable(std::unique_lock<std::mutex>& lock) {
+    // Writers only stall here: when both memtable slots are full, or when
+    // L0 has piled up faster than compaction drains it
+    auto can_switch = [this] {
+        return (!imm_ && static_cast<int>((*levels_)[0].size()) < options_.l0_stop_writes_trigger) ||
+               bg_error_;
+    };
+    if (!can_switch()) {
+        auto start = std::chrono::steady_clock::now();
+        bg_done_cv_.wait(lock, can_switch);
+        stats_->record_tick(Ticker::STALL_COUNT);
+        stats_->record_tick(Ticker::STALL_MICROS, std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    if (bg_error_) {
         return false;
     }
+    if (mem_->empty()) {
+        return true;
+    }
 
-    // Remove from memtable
-    auto it = memtable_.find(key);
-    if (it != memtable_.end()) {
-        current_memtable_size_ -= it->first.size() + it->second.size();
-        memtable_.erase(it);
+    std::string old_log = wal_->filename();
+    std::string reuse;
+    if (!recycled_logs_.empty()) {
+        reuse = recycled_logs_.back();
+        recycled_logs_.pop_back();
+    }
+    if (!wal_->switch_file(log_filename(++next_file_number_), reuse)) {
+        return false;
     }
 
+    imm_ = std::move(mem_);
+    imm_log_ = old_log;
+    mem_ = new_memtable();
+    flush_cv_.notify_one();
     return true;
 }
 
-void KVStore::recover() {
-    load_existing_sstables();
-    replay_wal();
+void KVStore::background_flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        flush_cv_.wait(lock, [this] { return imm_ || shutting_down_; });
+        if (!imm_) {
+            break;  // shutting down with nothing left to flush
+        }
+
+        // Write the immutable memtable without blocking readers or writers
+        std::shared_ptr<const MemTable> imm = imm_;
+        uint64_t number = ++next_file_number_;
+        lock.unlock();
+        TablePtr table;
+        {
+            StopWatch timer(stats_, Histogram::FLUSH);
+            table = build_table(*imm, number);
+        }
+        lock.lock();
+
+        bool ok = table != nullptr;
+        if (ok) {
+            VersionEdit edit;
+            edit.added.push_back(describe_table(*table, 0));
+            ok = log_edit(edit);
+        }
+        if (ok) {
+            stats_->record_tick(Ticker::FLUSH_COUNT);
+            stats_->record_tick(Ticker::FLUSH_BYTES, table->file_size());
+            auto levels = std::make_shared<Levels>(*levels_);
+            (*levels)[0].push_back(std::move(table));
+            levels_ = std::move(levels);
+            update_blob_files();
+            imm_.reset();
+            retire_log(imm_log_);
+            compaction_cv_.notify_one();
+        } else {
+            std::cerr << "MiniKV: failed to flush memtable to " << sstable_filename(number) << "\n";
+            bg_error_ = true;
+        }
+        bg_done_cv_.notify_all();
+        if (bg_error_) {
+            break;
+        }
+    }
 }
 
-void KVStore::replay_wal() {
-    auto entries = wal_->read_all();
-    for (const auto& entry : entries) {
-        if (entry.op_type == WAL::OpType::PUT) {
-            memtable_[entry.key] = entry.value;
-            current_memtable_size_ += entry.key.size() + entry.value.size();
-        } else if (entry.op_type == WAL::OpType::DELETE) {
-            auto it = memtable_.find(entry.key);
-            if (it != memtable_.end()) {
-                current_memtable_size_ -= it->first.size() + it->second.size();
-                memtable_.erase(it);
+void KVStore::background_compaction() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        Compaction c;
+        BlobGC gc;
+        compaction_cv_.wait(lock, [&] {
+            if (shutting_down_) return true;
+            if (bg_error_) return false;
+            return pick_manual_compaction(c) || pick_compaction(c) || pick_blob_gc(gc);
+        });
+        if (shutting_down_) {
+            break;
+        }
+
+        // Merge without holding the lock; flushes only ever add to L0 and
+        // this thread is the only one that removes tables
+        lock.unlock();
+        std::vector<TablePtr> outputs;
+        bool ok = gc.file ? run_blob_gc(gc, outputs) : run_compaction(c, outputs);
+        lock.lock();
+
+        if (ok && gc.file && install_blob_gc(gc, outputs)) {
+            stats_->record_tick(Ticker::BLOB_GC_COUNT);
+        } else if (gc.file) {
+            std::cerr << "MiniKV: garbage collection of " << gc.file->filename() << " failed\n";
+            bg_error_ = true;
+        } else if (ok && install_compaction(c, outputs)) {
+            stats_->record_tick(Ticker::COMPACTION_COUNT);
+            for (const auto& inputs : c.inputs) {
+                for (const auto& table : inputs) {
+                    stats_->record_tick(Ticker::COMPACTION_BYTES_READ, table->file_size());
+                }
             }
+            for (const auto& table : outputs) {
+                stats_->record_tick(Ticker::COMPACTION_BYTES_WRITTEN, table->file_size());
+            }
+        } else {
+            std::cerr << "MiniKV: compaction of level " << c.level << " failed\n";
+            bg_error_ = true;
         }
+        bg_done_cv_.notify_all();
     }
 }
 
-void KVStore::flush_to_sstable() {
-    if (memtable_.empty()) return;
+uint64_t KVStore::max_bytes_for_level(int level) const {
+    uint64_t bytes = options_.max_bytes_for_level_base;
+    for (int i = 1; i < level; ++i) {
+        bytes *= options_.level_size_multiplier;
+    }
+    return bytes;
+}
 
-    std::string filename = generate_sstable_filename();
-    auto sstable = std::make_unique<SSTable>(filename);
+double KVStore::level_score(int level) const {
+    if (level == 0) {
+        // Counted in files: every L0 table costs a lookup on reads
+        return static_cast<double>((*levels_)[0].size()) / std::max(options_.l0_compaction_trigger, 1);
+    }
+    if (level + 1 >= static_cast<int>(levels_->size())) {
+        return 0;  // the last level has nowhere to go
+    }
+    uint64_t bytes = 0;
+    for (const auto& table : (*levels_)[level]) {
+        bytes += table->file_size();
+    }
+    return static_cast<double>(bytes) / max_bytes_for_level(level);
+}
+
+bool KVStore::pick_compaction(Compaction& c) {
+    int best_level = -1;
+    double best_score = 1.0;
+    for (int level = 0; level < static_cast<int>(levels_->size()); ++level) {
+        double score = level_score(level);
+        if (score >= best_score) {
+            best_level = level;
+            best_score = score;
+        }
+    }
+    if (best_level < 0) {
+        return false;
+    }
 
-    if (sstable->write(memtable_)) {
-        sstables_.push_back(std::move(sstable));
-        memtable_.clear();
-        current_memtable_size_ = 0;
-        wal_->clear(); // Clear WAL after successful flush
+    c.level = best_level;
+    if (best_level == 0) {
+        c.inputs[0] = (*levels_)[0];
+    } else {
+        // Rotate through the key space: take the first table past the
+        // previous compaction of this level
+        const auto& tables = (*levels_)[best_level];
+        std::string& pointer = compact_pointer_[best_level];
+        auto it = std::find_if(tables.begin(), tables.end(),
+                               [&](const TablePtr& t) { return t->largest_key() > pointer; });
+        if (it == tables.end()) {
+            it = tables.begin();
+        }
+        c.inputs[0].push_back(*it);
+        pointer = (*it)->largest_key();
     }
+    setup_compaction_inputs(c);
+    return true;
 }
 
-std::string KVStore::generate_sstable_filename() {
-    static int counter = 0;
-    return data_dir_ + "/sstable_" + std::to_string(++counter) + ".sst";
+bool KVStore::pick_manual_compaction(Compaction& c) {
+    while (manual_level_ >= 0 && manual_level_ < manual_end_ && (*levels_)[manual_level_].empty()) {
+        ++manual_level_;
+    }
+    if (manual_level_ < 0) {
+        return false;
+    }
+    if (manual_level_ >= manual_end_) {
+        manual_level_ = -1;
+        bg_done_cv_.notify_all();
+        return false;
+    }
+
+    // Push the whole level into the next one
+    c.level = manual_level_++;
+    c.inputs[0] = (*levels_)[c.level];
+    setup_compaction_inputs(c);
+    return true;
+}
+
+void KVStore::setup_compaction_inputs(Compaction& c) {
+    std::string smallest = c.inputs[0].front()->smallest_key();
+    std::string largest = c.inputs[0].front()->largest_key();
+    for (const auto& table : c.inputs[0]) {
+        smallest = std::min(smallest, table->smallest_key());
+        largest = std::max(largest, table->largest_key());
+    }
+
+    for (const auto& table : (*levels_)[c.level + 1]) {
+        if (table->largest_key() >= smallest && table->smallest_key() <= largest) {
+            c.inputs[1].push_back(table);
+        }
+    }
+    c.deeper.assign(levels_->begin() + c.level + 2, levels_->end());
+
+    // Snapshots taken later see at least what is visible now
+    std::lock_guard<std::mutex> lock(snapshots_->mutex);
+    c.smallest_snapshot = snapshots_->sequences.empty() ? visible_sequence_.load()
+                                                        : *snapshots_->sequences.begin();
+}
+
+bool KVStore::run_compaction(const Compaction& c, std::vector<TablePtr>& outputs) {
+    // Sources newest first: later L0 tables, then the level being compacted,
+    // then the level below it. Compaction reads bypass the block cache.
+    std::vector<std::unique_ptr<InternalIterator>> sources;
+    for (auto rit = c.inputs[0].rbegin(); rit != c.inputs[0].rend(); ++rit) {
+        sources.push_back(new_table_iterator(*rit, false));
+    }
+    sources.push_back(new_level_iterator(c.inputs[1], false));
+    MergingIterator merged(std::move(sources));
+
+    // Outputs are written under temporary names and only renamed once all
+    // of them are complete, so a crash never leaves half a compaction behind
+    std::vector<std::string> temp_files;
+    std::shared_ptr<SSTable> output;
+    auto discard = [&] {
+        for (const auto& name : temp_files) {
+            std::error_code ec;
+            std::filesystem::remove(name, ec);
+        }
+        return false;
+    };
+    auto finish_output = [&] {
+        bool ok = output->finish_write();
+        output.reset();
+        return ok;
+    };
+
+    std::string current_key;
+    bool has_current = false;
+    uint64_t last_sequence_for_key = kMaxSequence;
+    for (merged.seek_to_first(); merged.valid(); merged.next()) {
+        // The merge yields the versions of a key newest first. A version is
+        // dropped once a newer one is visible to every reader, and so is a
+        // tombstone every reader sees that nothing deeper can still be hiding.
+        bool new_key = !has_current || merged.key() != current_key;
+        if (new_key) {
+            current_key.assign(merged.key());
+            has_current = true;
+            last_sequence_for_key = kMaxSequence;
+        }
+        uint64_t sequence = merged.sequence();
+        bool drop;
+        if (last_sequence_for_key <= c.smallest_snapshot) {
+            drop = true;
+        } else {
+            drop = merged.deleted() && sequence <= c.smallest_snapshot &&
+                   std::none_of(c.deeper.begin(), c.deeper.end(), [&](const std::vector<TablePtr>& level) {
+                       return find_table(level, current_key) != nullptr;
+                   });
+        }
+        last_sequence_for_key = sequence;
+
+        if (!drop) {
+            // Versions of one key never straddle two tables of a level
+            if (output && new_key && output->file_size() >= options_.target_file_size &&
+                !finish_output()) {
+                return discard();
+            }
+            if (!output) {
+                uint64_t number;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    number = ++next_file_number_;
+                }
+                temp_files.push_back(sstable_filename(number) + ".tmp");
+                output = std::make_shared<SSTable>(temp_files.back(), options_);
+                if (!output->begin_write(c.level + 1)) {
+                    return discard();
+                }
+            }
+            if (merged.is_blob_index()) {
+                output->add_blob_index(current_key, merged.value(), sequence);
+            } else {
+                output->add(current_key, merged.value(), merged.deleted(), sequence);
+            }
+        }
+    }
+    if (output && !finish_output()) {
+        return discard();
+    }
+
+    // Renamed outputs are tracked under their final names, so a failure
+    // part way through still removes all of them
+    for (auto& file : temp_files) {
+        std::string name = file.substr(0, file.size() - 4);
+        std::error_code ec;
+        std::filesystem::rename(file, name, ec);
+        if (ec) {
+            outputs.clear();
+            return discard();
+        }
+        file = name;
+        auto table = std::make_shared<SSTable>(name, options_);
+        if (!table->is_valid()) {
+            outputs.clear();
+            return discard();
+        }
+        outputs.push_back(std::move(table));
+    }
+    return true;
+}
+
+bool KVStore::install_compaction(const Compaction& c, const std::vector<TablePtr>& outputs) {
+    VersionEdit edit;
+    for (const auto& inputs : c.inputs) {
+        for (const auto& table : inputs) {
+            edit.removed.push_back(describe_table(*table, 0).number);
+        }
+    }
+    for (const auto& table : outputs) {
+        edit.added.push_back(describe_table(*table, c.level + 1));
+    }
+    if (!log_edit(edit)) {
+        return false;
+    }
+
+    // Readers may still hold the old levels, so build new ones
+    auto levels = std::make_shared<Levels>(*levels_);
+    for (int which = 0; which < 2; ++which) {
+        auto& level = (*levels)[c.level + which];
+        const auto& inputs = c.inputs[which];
+        level.erase(std::remove_if(level.begin(), level.end(), [&](const TablePtr& t) {
+            return std::find(inputs.begin(), inputs.end(), t) != inputs.end();
+        }), level.end());
+    }
+
+    auto& target = (*levels)[c.level + 1];
+    target.insert(target.end(), outputs.begin(), outputs.end());
+    std::sort(target.begin(), target.end(), [](const TablePtr& a, const TablePtr& b) {
+        return a->smallest_key() < b->smallest_key();
+    });
+    levels_ = std::move(levels);
+
+    // Nothing references the inputs once they leave the levels
+    for (const auto& inputs : c.inputs) {
+        for (const auto& table : inputs) {
+            std::error_code ec;
+            std::filesystem::remove(table->filename(), ec);
+        }
+    }
+    update_blob_files();
+    return true;
+}
+
+bool KVStore::pick_blob_gc(BlobGC& gc) const {
+    if (blob_files_->empty()) {
+        return false;
+    }
+
+    // Bytes of each blob file still pointed at. Files L0 tables point into
+    // wait: rewriting an L0 table would give it a newer number and so move
+    // it in the search order on recovery.
+    std::map<uint64_t, uint64_t> live;
+    std::set<uint64_t> in_level0;
+    for (size_t level = 0; level < levels_->size(); ++level) {
+        for (const auto& table : (*levels_)[level]) {
+            for (const auto& [number, bytes] : table->blob_references()) {
+                live[number] += bytes;
+                if (level == 0) in_level0.insert(number);
+            }
+        }
+    }
+
+    // The file with the most garbage past the threshold
+    double best = options_.blob_gc_threshold;
+    for (const auto& [number, file] : *blob_files_) {
+        if (in_level0.count(number) || file->data_size() == 0) continue;
+        double garbage = 1.0 - static_cast<double>(live[number]) / file->data_size();
+        if (garbage > 0 && garbage >= best) {
+            best = garbage;
+            gc.file = file;
+        }
+    }
+    if (!gc.file) {
+        return false;
+    }
+    for (const auto& level : *levels_) {
+        for (const auto& table : level) {
+            if (table->blob_references().count(gc.file->file_number())) {
+                gc.tables.push_back(table);
+            }
+        }
+    }
+    return true;
+}
+
+bool KVStore::run_blob_gc(const BlobGC& gc, std::vector<TablePtr>& outputs) {
+    uint64_t blob_number;
+    std::vector<uint64_t> numbers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blob_number = ++next_file_number_;
+        for (size_t i = 0; i < gc.tables.size(); ++i) {
+            numbers.push_back(++next_file_number_);
+        }
+    }
+
+    // As with compaction, the tables are written under temporary names and
+    // renamed once all of them and the new blob file are complete
+    BlobFileBuilder blobs(blob_filename(blob_number), blob_number);
+    std::vector<std::string> temp_files;
+    auto discard = [&] {
+        std::error_code ec;
+        for (const auto& name : temp_files) {
+            std::filesystem::remove(name, ec);
+        }
+        std::filesystem::remove(blobs.filename(), ec);
+        return false;
+    };
+
+    std::string record, index;
+    for (size_t i = 0; i < gc.tables.size(); ++i) {
+        const TablePtr& table = gc.tables[i];
+        temp_files.push_back(sstable_filename(numbers[i]) + ".tmp");
+        SSTable output(temp_files.back(), options_);
+        if (!output.begin_write(table->level())) {
+            return discard();
+        }
+
+        // Same entries, same level; only pointers into the old file change
+        SSTable::Iterator it(table.get(), false);
+        for (it.seek_to_first(); it.valid(); it.next()) {
+            BlobIndex blob;
+            if (!it.is_blob_index()) {
+                output.add(it.key(), it.value(), it.deleted(), it.sequence());
+            } else if (!blob.decode_from(it.value()) || blob.file_number != gc.file->file_number()) {
+                output.add_blob_index(it.key(), it.value(), it.sequence());
+            } else {
+                if (!gc.file->read_record(blob, record) || !blobs.add_record(record, blob)) {
+                    return discard();
+                }
+                index.clear();
+                blob.encode_to(index);
+                output.add_blob_index(it.key(), index, it.sequence());
+            }
+        }
+        if (!output.finish_write()) {
+            return discard();
+        }
+    }
+    if (!blobs.finish()) {
+        return discard();
+    }
+
+    // Renamed tables are tracked under their final names so that, as in
+    // run_compaction, a failure still removes them and the blob file
+    for (auto& file : temp_files) {
+        std::string name = file.substr(0, file.size() - 4);
+        std::error_code ec;
+        std::filesystem::rename(file, name, ec);
+        if (ec) {
+            outputs.clear();
+            return discard();
+        }
+        file = name;
+        auto table = std::make_shared<SSTable>(name, options_);
+        if (!table->is_valid()) {
+            outputs.clear();
+            return discard();
+        }
+        outputs.push_back(std::move(table));
+    }
+    stats_->record_tick(Ticker::BLOB_BYTES_WRITTEN, blobs.data_size());
+    stats_->record_tick(Ticker::BLOB_GC_BYTES, blobs.data_size());
+    return true;
+}
+
+bool KVStore::install_blob_gc(const BlobGC& gc, const std::vector<TablePtr>& outputs) {
+    // Each rewritten table takes its original's place
+    VersionEdit edit;
+    auto levels = std::make_shared<Levels>(*levels_);
+    for (size_t level = 0; level < levels->size(); ++level) {
+        for (auto& table : (*levels)[level]) {
+            auto it = std::find(gc.tables.begin(), gc.tables.end(), table);
+            if (it != gc.tables.end()) {
+                edit.removed.push_back(describe_table(*table, 0).number);
+                table = outputs[it - gc.tables.begin()];
+                edit.added.push_back(describe_table(*table, static_cast<int>(level)));
+            }
+        }
+    }
+    if (!log_edit(edit)) {
+        return false;
+    }
+    levels_ = std::move(levels);
+
+    for (const auto& table : gc.tables) {
+        std::error_code ec;
+        std::filesystem::remove(table->filename(), ec);
+    }
+    update_blob_files();
+    return true;
+}
+
+void KVStore::update_blob_files() {
+    // Readers that pinned the old set keep reading deleted files through
+    // their open descriptors
+    auto blobs = std::make_shared<BlobFiles>();
+    for (const auto& level : *levels_) {
+        for (const auto& table : level) {
+            for (const auto& [number, bytes] : table->blob_references()) {
+                if (blobs->count(number)) continue;
+                auto it = blob_files_->find(number);
+                (*blobs)[number] = it != blob_files_->end()
+                    ? it->second : std::make_shared<BlobFile>(blob_filename(number), number);
+            }
+        }
+    }
+    for (const auto& [number, file] : *blob_files_) {
+        if (blobs->count(number) == 0) {
+            std::error_code ec;
+            std::filesystem::remove(file->filename(), ec);
+        }
+    }
+    blob_files_ = std::move(blobs);
+}
+
+std::shared_ptr<MemTable> KVStore::new_memtable() const {
+    // About eight arena blocks per memtable: few enough mallocs to keep the
+    // heap quiet, small enough that the last block wastes little
+    size_t block_size = std::clamp<size_t>(memtable_size_limit_ / 8, 1024, 1024 * 1024);
+    return std::make_shared<MemTable>(block_size);
+}
+
+KVStore::TablePtr KVStore::build_table(const MemTable& mem, uint64_t number) {
+    // Large values go to a blob file with the table's number, which is
+    // complete before the table pointing into it
+    auto sstable = std::make_shared<SSTable>(sstable_filename(number), options_);
+    BlobFileBuilder blobs(blob_filename(number), number);
+    if (!sstable->begin_write()) {
+        return nullptr;
+    }
+    bool ok = true;
+    std::string index;
+    MemTable::Iterator it(&mem);
+    for (it.seek_to_first(); ok && it.valid(); it.next()) {
+        if (options_.min_blob_size == 0 || it.deleted() || it.value().size() < options_.min_blob_size) {
+            sstable->add(it.key(), it.value(), it.deleted(), it.sequence());
+            continue;
+        }
+        BlobIndex blob;
+        ok = blobs.add(it.key(), it.value(), blob);
+        index.clear();
+        blob.encode_to(index);
+        sstable->add_blob_index(it.key(), index, it.sequence());
+    }
+    ok = blobs.finish() && ok && sstable->finish_write();
+    if (!ok) {
+        std::error_code ec;
+        std::filesystem::remove(blobs.filename(), ec);
+        std::filesystem::remove(sstable->filename(), ec);
+        return nullptr;
+    }
+    stats_->record_tick(Ticker::BLOB_BYTES_WRITTEN, blobs.data_size());
+    return sstable;
+}
+
+std::string KVStore::sstable_filename(uint64_t number) const {
+    return data_dir_ + "/sstable_" + std::to_string(number) + ".sst";
+}
+
+std::string KVStore::log_filename(uint64_t number) const {
+    return data_dir_ + "/wal_" + std::to_string(number) + ".log";
+}
+
+std::string KVStore::blob_filename(uint64_t number) const {
+    return data_dir_ + "/blob_" + std::to_string(number) + ".blob";
+}
+
+void KVStore::retire_log(const std::string& filename) {
+    // Renamed out of the wal_ namespace first, so recovery never replays it
+    std::error_code ec;
+    bool recycled = filename.size() > 8 && filename.compare(filename.size() - 8, 8, ".recycle") == 0;
+    if (recycled_logs_.size() < options_.wal_recycle_limit) {
+        std::string target = recycled ? filename : filename + ".recycle";
+        std::filesystem::rename(filename, target, ec);
+        if (!ec) {
+            recycled_logs_.push_back(target);
+            return;
+        }
+    }
+    std::filesystem::remove(filename, ec);
 }
 
 void KVStore::load_existing_sstables() {
-    // Load existing SSTable files from data directory
+    // Load existing SSTable files from data directory, oldest first
+    std::vector<std::pair<uint64_t, std::string>> files;
     for (const auto& entry : std::filesystem::directory_iterator(data_dir_)) {
-        if (entry.path().extension() == ".sst") {
-            auto sstable = std::make_unique<SSTable>(entry.path().string());
-            if (sstable->is_valid()) {
-                sstables_.push_back(std::move(sstable));
+        if (entry.path().extension() == ".tmp") {
+            // Output of a compaction that never finished
+            std::error_code ec;
+            std::filesystem::remove(entry.path(), ec);
+        } else if (entry.path().extension() == ".blob") {
+            // Blob files share the numbering, so new tables never reuse theirs
+            uint64_t number = 0;
+            parse_file_number(entry.path().filename().string(), "blob_", ".blob", number);
+            next_file_number_ = std::max(next_file_number_, number);
+        } else if (entry.path().extension() == ".sst") {
+            uint64_t number = 0;
+            parse_file_number(entry.path().filename().string(), "sstable_", ".sst", number);
+            next_file_number_ = std::max(next_file_number_, number);
+            files.push_back({number, entry.path().string()});
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<TablePtr> tables(files.size());
+    parallel_for(files.size(), options_.max_open_threads, [&](size_t i) {
+        tables[i] = std::make_shared<SSTable>(files[i].second, options_);
+    });
+
+    auto levels = std::make_shared<Levels>(options_.num_levels);
+    for (auto& sstable : tables) {
+        if (sstable->is_valid()) {
+            visible_sequence_.store(std::max(visible_sequence_.load(), sstable->largest_sequence()));
+            int level = std::min(sstable->level(), options_.num_levels - 1);
+            (*levels)[level].push_back(std::move(sstable));
+        }
+    }
+
+    // A compaction interrupted before it deleted its inputs leaves them
+    // overlapping its (newer) outputs; the outputs already hold their data
+    for (size_t level = 1; level < levels->size(); ++level) {
+        std::vector<TablePtr> kept;
+        for (auto rit = (*levels)[level].rbegin(); rit != (*levels)[level].rend(); ++rit) {
+            const TablePtr& table = *rit;
+            bool overlaps = std::any_of(kept.begin(), kept.end(), [&](const TablePtr& t) {
+                return t->largest_key() >= table->smallest_key() &&
+                       t->smallest_key() <= table->largest_key();
+            });
+            if (overlaps) {
+                std::error_code ec;
+                std::filesystem::remove(table->filename(), ec);
+            } else {
+                kept.push_back(table);
             }
         }
+        std::sort(kept.begin(), kept.end(), [](const TablePtr& a, const TablePtr& b) {
+            return a->smallest_key() < b->smallest_key();
+        });
+        (*levels)[level] = std::move(kept);
     }
+    levels_ = std::move(levels);
 }
 
-bool KVStore::create_snapshot() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    // Implementation for snapshotting
-    return true;
+bool KVStore::log_edit(VersionEdit& edit) {
+    // The files the edit adds are synced already; their directory entries
+    // must be too before the manifest points at them
+    edit.next_file_number = next_file_number_;
+    if (utils::sync_dir(data_dir_) && manifest_->log_and_apply(edit)) {
+        return true;
+    }
+    std::cerr << "MiniKV: failed to write " << data_dir_ << "/MANIFEST\n";
+    return false;
+}
+
+bool KVStore::save_manifest() {
+    VersionEdit edit;
+    edit.next_file_number = next_file_number_;
+    for (size_t level = 0; level < levels_->size(); ++level) {
+        for (const auto& table : (*levels_)[level]) {
+            edit.added.push_back(describe_table(*table, static_cast<int>(level)));
+        }
+    }
+    return manifest_->reset(edit);
+}
+
+std::shared_ptr<const Snapshot> KVStore::create_snapshot() {
+    std::shared_ptr<SnapshotList> list = snapshots_;
+    std::lock_guard<std::mutex> lock(list->mutex);
+    uint64_t sequence = visible_sequence_.load(std::memory_order_acquire);
+    list->sequences.insert(sequence);
+
+    // Releasing the last handle unregisters it, so compaction can drop the
+    // versions only it could see
+    return std::shared_ptr<const Snapshot>(new Snapshot(sequence), [list](const Snapshot* snapshot) {
+        {
+            std::lock_guard<std::mutex> lock(list->mutex);
+            list->sequences.erase(list->sequences.find(snapshot->sequence()));
+        }
+        delete snapshot;
+    });
 }
 
 void KVStore::flush_memtable() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    flush_to_sstable();
+    wal_->run_exclusive([this] {
+        std::unique_lock<std::mutex> lock(mutex_);
+        switch_memtable(lock);
+    });
+
+    // Wait for the background thread to write it out
+    std::unique_lock<std::mutex> lock(mutex_);
+    bg_done_cv_.wait(lock, [this] { return !imm_ || bg_error_; });
 }
 
 void KVStore::compact() {
-    // Implementation for compaction
+    flush_memtable();
+
+    // Push every level down until all data sits in the deepest non-empty one
+    std::unique_lock<std::mutex> lock(mutex_);
+    int end = 1;
+    for (int level = 1; level < static_cast<int>(levels_->size()); ++level) {
+        if (!(*levels_)[level].empty()) {
+            end = level;
+        }
+    }
+    manual_level_ = 0;
+    manual_end_ = end;
+    compaction_cv_.notify_one();
+    bg_done_cv_.wait(lock, [this] {
+        BlobGC gc;
+        return (manual_level_ < 0 && !pick_blob_gc(gc)) || bg_error_ || shutting_down_;
+    });
+}
+
+size_t KVStore::num_tables_at_level(int level) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (level < 0 || level >= static_cast<int>(levels_->size())) {
+        return 0;
+    }
+    return (*levels_)[level].size();
+}
+
+StatsSnapshot KVStore::get_stats() const {
+    StatsSnapshot stats = stats_->snapshot();
+    if (options_.block_cache) {
+        stats.block_cache_hits = options_.block_cache->hits();
+        stats.block_cache_misses = options_.block_cache->misses();
+    }
+    return stats;
 }
 
 void KVStore::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutting_down_ = true;
+    }
+    flush_cv_.notify_all();
+    compaction_cv_.notify_all();
+    bg_done_cv_.notify_all();
+    if (flush_thread_.joinable()) {
+        flush_thread_.join();
+    }
+    if (compaction_thread_.joinable()) {
+        compaction_thread_.join();
+    }
+
     if (wal_) {
         wal_->close();
     }
@@ -4,43 +4,245 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <vector>
+#include <set>
+#include <atomic>
+#include <string_view>
+#include <optional>
+#include "wal.hpp"
+#include "options.hpp"
+#include "statistics.hpp"
 
-class WAL;
 class SSTable;
+class BlobFile;
+class MemTable;
+class WriteBatch;
+class InternalIterator;
+class Manifest;
+struct VersionEdit;
+
+// A point-in-time view of the store, from KVStore::create_snapshot. Reads
+// given it see exactly the writes made before it was taken, and compaction
+// keeps the versions it can see for as long as the handle lives.
+class Snapshot {
+public:
+    explicit Snapshot(uint64_t sequence) : sequence_(sequence) {}
+    uint64_t sequence() const { return sequence_; }
+
+private:
+    uint64_t sequence_;
+};
 
 class KVStore {
+    // Blob files by number
+    using BlobFiles = std::map<uint64_t, std::shared_ptr<BlobFile>>;
+
 public:
-    KVStore(const std::string& data_dir = "./data");
+    KVStore(const std::string& data_dir = "./data", const Options& options = Options());
     ~KVStore();
 
     // Core operations
     bool put(const std::string& key, const std::string& value);
-    bool get(const std::string& key, std::string& value);
+    bool get(const std::string& key, std::string& value, const ReadOptions& options = ReadOptions());
     bool remove(const std::string& key);
+    bool write(const WriteBatch& batch);
+    // get for every key in one pass over the store: the keys are sorted and
+    // each table is searched once for all those it may hold. A key that
+    // isn't found comes back empty.
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys,
+                                                      const ReadOptions& options = ReadOptions());
+
+    // Ordered scan over the store as of the moment it was created, or as of
+    // options.snapshot. Later writes are not visible; deleted keys and old
+    // versions are skipped. A value whose blob record can't be read comes
+    // back empty.
+    class Iterator {
+    public:
+        ~Iterator();
+
+        void seek_to_first();
+        void seek_to_last();
+        // Positions at the first visible key >= key
+        void seek(const std::string& key);
+        bool valid() const;
+        void next();
+        void prev();
+
+        std::string_view key() const;
+        std::string_view value() const;
+
+    private:
+        friend class KVStore;
+        Iterator(std::unique_ptr<InternalIterator> iter, std::shared_ptr<const BlobFiles> blobs,
+                 const ReadOptions& options, uint64_t sequence);
+
+        std::unique_ptr<InternalIterator> iter_;
+        std::shared_ptr<const BlobFiles> blobs_;  // the ones iter_'s tables point into
+        uint64_t sequence_;  // entries written after this are ignored
+        std::string lower_;  // inclusive; the prefix
+        std::string upper_;  // exclusive; empty when unbounded
+        bool forward_;
+        bool valid_;
+
+        // Going forward iter_ sits on the current entry; going backward it
+        // sits before it, so the entry is copied out. Values read from a
+        // blob file are kept in saved_value_ either way.
+        std::string saved_key_;
+        std::string saved_value_;
+        bool blob_;  // going forward, the current value is in saved_value_
+
+        bool in_range(std::string_view key) const;
+        void find_next_visible(bool skipping);
+        void find_prev_visible();
+    };
+
+    std::unique_ptr<Iterator> new_iterator(const ReadOptions& options = ReadOptions());
+
+    // Pins the current state for reads through ReadOptions::snapshot until
+    // the handle is released
+    std::shared_ptr<const Snapshot> create_snapshot();
 
     // Management operations
-    bool create_snapshot();
     void flush_memtable();
+    // Pushes every level down into the deepest one, then garbage collects
+    // blob files until none is over options.blob_gc_threshold
     void compact();
     void close();
 
+    // Number of SSTables currently in the given level
+    size_t num_tables_at_level(int level);
+
+    // Counters and latency histograms of options.statistics, plus the hit
+    // counts of the block cache
+    StatsSnapshot get_stats() const;
+
 private:
+    using TablePtr = std::shared_ptr<SSTable>;
+    using Levels = std::vector<std::vector<TablePtr>>;
+
+    // A unit of background work: inputs[0] from `level`, inputs[1] from the
+    // level below, merged into new tables in `level + 1`
+    struct Compaction {
+        int level = 0;
+        std::vector<TablePtr> inputs[2];
+        std::vector<std::vector<TablePtr>> deeper;  // levels below the output, for dropping tombstones
+        uint64_t smallest_snapshot = 0;  // versions hidden from every reader at or after this go
+    };
+
+    // Blob garbage collection: the records of `file` that tables still
+    // point at are copied to a new blob file, and `tables` are rewritten
+    // one for one to point at the copies
+    struct BlobGC {
+        std::shared_ptr<BlobFile> file;
+        std::vector<TablePtr> tables;
+    };
+
+    // Sequences of live snapshots. Shared with the handles' deleters, which
+    // may run after the store is gone.
+    struct SnapshotList {
+        std::mutex mutex;
+        std::multiset<uint64_t> sequences;
+    };
+
     std::string data_dir_;
-    std::map<std::string, std::string> memtable_;
+    Options options_;
+    std::shared_ptr<MemTable> mem_;  // written lock-free by the WAL group leader
+    std::shared_ptr<MemTable> imm_;  // full memtable being flushed in the background
+    std::string imm_log_;            // WAL segment holding imm_'s records
+    std::vector<std::string> recycled_logs_;  // flushed segments waiting for reuse
     std::unique_ptr<WAL> wal_;
-    std::vector<std::unique_ptr<SSTable>> sstables_;
+    Statistics* stats_;  // options_.statistics, never null
+    // L0 holds flushed tables oldest first and they may overlap; deeper
+    // levels are sorted by smallest key and their ranges are disjoint.
+    // Never modified in place: readers pin it and search without mutex_.
+    std::shared_ptr<const Levels> levels_;
+    std::vector<std::string> compact_pointer_;  // per level: largest key of its last compaction
+    // Blob files tables point into; replaced along with levels_ and pinned
+    // with it by readers
+    std::shared_ptr<const BlobFiles> blob_files_;
+    // Log of the tables in levels_; every change is recorded in it, under
+    // mutex_, before it is installed
+    std::unique_ptr<Manifest> manifest_;
     std::mutex mutex_;
 
+    // Sequence of the last write applied to mem_; reads without a snapshot
+    // see everything up to it
+    std::atomic<uint64_t> visible_sequence_;
+    std::shared_ptr<SnapshotList> snapshots_;
+
+    // Background flush and compaction
+    std::thread flush_thread_;
+    std::thread compaction_thread_;
+    std::condition_variable flush_cv_;       // wakes the flush thread
+    std::condition_variable compaction_cv_;  // wakes the compaction thread
+    std::condition_variable bg_done_cv_;     // signalled when a flush or compaction finishes
+    bool shutting_down_;
+    bool bg_error_;
+    int manual_level_;  // next level compact() pushes down, -1 when idle
+    int manual_end_;    // compact() stops once data reaches this level
+
+    uint64_t next_file_number_;
     size_t memtable_size_limit_;
-    size_t current_memtable_size_;
+
+    // get without the accounting
+    bool lookup(const std::string& key, std::string& value, const ReadOptions& options);
 
     // Recovery
     void recover();
-    void replay_wal();
+    // False if a table the manifest lists can't be opened
+    bool load_manifest_tables();
+    // False if the log couldn't be turned into tables; its segments are
+    // kept for the next open
+    bool replay_wal();
+    // Deletes files no longer part of the store: tables the manifest
+    // doesn't list, unreferenced blob files and leftover temporary files
+    void remove_obsolete_files();
+
+    // Memtable switching; callers run inside wal_->run_exclusive
+    bool make_room_for_write();
+    bool switch_memtable(std::unique_lock<std::mutex>& lock);
+    std::shared_ptr<MemTable> new_memtable() const;
+    uint64_t read_sequence(const ReadOptions& options) const;
+    void background_flush();
+
+    // Compaction; the pick_* helpers and install_compaction need mutex_ held
+    void background_compaction();
+    double level_score(int level) const;
+    uint64_t max_bytes_for_level(int level) const;
+    bool pick_compaction(Compaction& c);
+    bool pick_manual_compaction(Compaction& c);
+    void setup_compaction_inputs(Compaction& c);
+    bool run_compaction(const Compaction& c, std::vector<TablePtr>& outputs);
+    bool install_compaction(const Compaction& c, const std::vector<TablePtr>& outputs);
+    static TablePtr find_table(const std::vector<TablePtr>& level, const std::string& key);
+
+    // Blob garbage collection; as with compaction, picking and installing
+    // need mutex_ held
+    bool pick_blob_gc(BlobGC& gc) const;
+    bool run_blob_gc(const BlobGC& gc, std::vector<TablePtr>& outputs);
+    bool install_blob_gc(const BlobGC& gc, const std::vector<TablePtr>& outputs);
+    // Opens blob files tables have started pointing into and deletes those
+    // none point into any more; needs mutex_ held once the background
+    // threads run
+    void update_blob_files();
 
     // SSTable management
-    void flush_to_sstable();
-    std::string generate_sstable_filename();
+    TablePtr build_table(const MemTable& mem, uint64_t number);
+    std::string sstable_filename(uint64_t number) const;
+    std::string log_filename(uint64_t number) const;
+    std::string blob_filename(uint64_t number) const;
+    // Keeps a segment whose records are all in tables for reuse, or deletes
+    // it; needs mutex_ held once the background threads run
+    void retire_log(const std::string& filename);
+    // Finds tables by listing the directory; only for stores from before
+    // the manifest
     void load_existing_sstables();
+
+    // Manifest updates; need mutex_ held once the background threads run.
+    // log_edit records edit along with next_file_number_, save_manifest
+    // starts a new log holding the whole of levels_.
+    bool log_edit(VersionEdit& edit);
+    bool save_manifest();
 };
@@ -0,0 +1,220 @@
+#include "lsm.hpp"
+#include "utils.hpp"
+#include <filesystem>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Edit fields, each a tag varint followed by its values
+constexpr uint64_t kTagNextFileNumber = 1;
+constexpr uint64_t kTagRemovedFile = 2;    // number
+constexpr uint64_t kTagAddedFile = 3;      // level, number, size, smallest, largest, sequence
+
+constexpr size_t kFrameHeaderSize = 2 * sizeof(uint32_t);
+constexpr uint32_t kChecksumSeed = 0x6d616e69;  // "mani"
+
+void put_string(std::string& out, std::string_view s) {
+    utils::put_varint(out, s.size());
+    out.append(s);
+}
+
+bool get_string(const char*& p, const char* limit, std::string& s) {
+    uint64_t len;
+    if (!utils::get_varint(p, limit, len) || len > static_cast<uint64_t>(limit - p)) return false;
+    s.assign(p, len);
+    p += len;
+    return true;
+}
+
+std::string dirname_of(const std::string& filename) {
+    std::string dir = std::filesystem::path(filename).parent_path().string();
+    return dir.empty() ? "." : dir;
+}
+
+}
+
+void VersionEdit::encode_to(std::string& out) const {
+    if (next_file_number != 0) {
+        utils::put_varint(out, kTagNextFileNumber);
+        utils::put_varint(out, next_file_number);
+    }
+    for (uint64_t number : removed) {
+        utils::put_varint(out, kTagRemovedFile);
+        utils::put_varint(out, number);
+    }
+    for (const auto& file : added) {
+        utils::put_varint(out, kTagAddedFile);
+        utils::put_varint(out, static_cast<uint64_t>(file.level));
+        utils::put_varint(out, file.number);
+        utils::put_varint(out, file.file_size);
+        put_string(out, file.smallest_key);
+        put_string(out, file.largest_key);
+        utils::put_varint(out, file.largest_sequence);
+    }
+}
+
+bool VersionEdit::decode_from(std::string_view in) {
+    *this = VersionEdit();
+    const char* p = in.data();
+    const char* limit = p + in.size();
+    while (p < limit) {
+        uint64_t tag, value;
+        if (!utils::get_varint(p, limit, tag)) {
+            return false;
+        }
+        if (tag == kTagNextFileNumber) {
+            if (!utils::get_varint(p, limit, next_file_number)) return false;
+        } else if (tag == kTagRemovedFile) {
+            if (!utils::get_varint(p, limit, value)) return false;
+            removed.push_back(value);
+        } else if (tag == kTagAddedFile) {
+            FileMetaData file;
+            uint64_t level;
+            if (!utils::get_varint(p, limit, level) || !utils::get_varint(p, limit, file.number) ||
+                !utils::get_varint(p, limit, file.file_size) || !get_string(p, limit, file.smallest_key) ||
+                !get_string(p, limit, file.largest_key) || !utils::get_varint(p, limit, file.largest_sequence)) {
+                return false;
+            }
+            file.level = static_cast<int>(level);
+            added.push_back(std::move(file));
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+Manifest::Manifest(const std::string& filename)
+    : filename_(filename), log_size_(0), next_file_number_(0) {
+}
+
+bool Manifest::recover() {
+    std::ifstream in(filename_, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // Apply edits up to the first damaged one; only the last can be torn
+    files_.clear();
+    next_file_number_ = 0;
+    bool any = false;
+    const char* p = data.data();
+    const char* limit = p + data.size();
+    VersionEdit edit;
+    while (static_cast<size_t>(limit - p) >= kFrameHeaderSize) {
+        uint32_t checksum, length;
+        std::memcpy(&checksum, p, sizeof(checksum));
+        std::memcpy(&length, p + sizeof(checksum), sizeof(length));
+        const char* record = p + kFrameHeaderSize;
+        if (length > static_cast<size_t>(limit - record) ||
+            utils::hash(record, length, kChecksumSeed) != checksum ||
+            !edit.decode_from(std::string_view(record, length))) {
+            break;
+        }
+        apply(edit);
+        any = true;
+        p = record + length;
+    }
+    return any;
+}
+
+bool Manifest::reset(const VersionEdit& edit) {
+    auto files = std::move(files_);
+    uint64_t next_file_number = next_file_number_;
+    files_.clear();
+    next_file_number_ = 0;
+    apply(edit);
+    if (write_snapshot()) {
+        return true;
+    }
+    files_ = std::move(files);
+    next_file_number_ = next_file_number;
+    return false;
+}
+
+bool Manifest::log_and_apply(const VersionEdit& edit) {
+    // Undone if it can't be logged, so a later snapshot never records an
+    // edit the caller was told failed
+    auto files = files_;
+    uint64_t next_file_number = next_file_number_;
+    apply(edit);
+    bool ok;
+    if (!log_.is_open() || log_size_ >= kMaxLogSize) {
+        ok = write_snapshot();
+    } else {
+        ok = append(log_, filename_, edit, log_size_);
+        if (!ok) {
+            // Records after a torn one are never replayed; start a new log
+            log_.close();
+        }
+    }
+    if (!ok) {
+        files_ = std::move(files);
+        next_file_number_ = next_file_number;
+    }
+    return ok;
+}
+
+const std::map<uint64_t, FileMetaData>& Manifest::files() const {
+    return files_;
+}
+
+uint64_t Manifest::next_file_number() const {
+    return next_file_number_;
+}
+
+void Manifest::apply(const VersionEdit& edit) {
+    for (uint64_t number : edit.removed) {
+        files_.erase(number);
+    }
+    for (const auto& file : edit.added) {
+        files_[file.number] = file;
+    }
+    next_file_number_ = std::max(next_file_number_, edit.next_file_number);
+}
+
+bool Manifest::write_snapshot() {
+    VersionEdit snapshot;
+    snapshot.next_file_number = next_file_number_;
+    for (const auto& [number, file] : files_) {
+        snapshot.added.push_back(file);
+    }
+
+    // The old log stays in place until the new one is complete
+    log_.close();
+    log_size_ = 0;
+    std::string temp = filename_ + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (!append(out, temp, snapshot, log_size_)) {
+        return false;
+    }
+    out.close();
+    std::error_code ec;
+    std::filesystem::rename(temp, filename_, ec);
+    if (ec || !utils::sync_dir(dirname_of(filename_))) {
+        return false;
+    }
+
+    log_.open(filename_, std::ios::binary | std::ios::app);
+    return log_.is_open();
+}
+
+bool Manifest::append(std::ofstream& out, const std::string& filename, const VersionEdit& edit,
+                      uint64_t& log_size) {
+    std::string record(kFrameHeaderSize, '\0');
+    edit.encode_to(record);
+    uint32_t length = static_cast<uint32_t>(record.size() - kFrameHeaderSize);
+    uint32_t checksum = utils::hash(record.data() + kFrameHeaderSize, length, kChecksumSeed);
+    std::memcpy(&record[0], &checksum, sizeof(checksum));
+    std::memcpy(&record[sizeof(checksum)], &length, sizeof(length));
+    out.write(record.data(), record.size());
+    out.flush();
+    if (!out || !utils::sync_file(filename)) {
+        return false;
+    }
+    log_size += record.size();
+    return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+// A live table as the manifest records it
+struct FileMetaData {
+    uint64_t number = 0;
+    int level = 0;
+    uint64_t file_size = 0;
+    std::string smallest_key;
+    std::string largest_key;
+    uint64_t largest_sequence = 0;
+};
+
+// One change to the set of live tables: a flush adds a table, a compaction
+// removes its inputs and adds its outputs
+struct VersionEdit {
+    std::vector<FileMetaData> added;
+    std::vector<uint64_t> removed;  // file numbers
+    uint64_t next_file_number = 0;  // 0 leaves it as it was
+
+    void encode_to(std::string& out) const;
+    bool decode_from(std::string_view in);
+};
+
+// Log of version edits, replayed at startup to find the live tables and
+// their levels without looking at the files themselves. Records are framed
+// as [checksum u32][length u32][edit], so a torn last record is ignored.
+//
+// The log is rewritten as a single edit holding the whole live set when
+// the store opens and whenever it grows past kMaxLogSize; the new log
+// replaces the old one by rename. Every record is synced before the call
+// that wrote it returns.
+class Manifest {
+public:
+    explicit Manifest(const std::string& filename);
+    Manifest(const Manifest&) = delete;
+    Manifest& operator=(const Manifest&) = delete;
+
+    // Replays an existing log; false if there is none or nothing in it
+    // could be read
+    bool recover();
+    // Makes edit, applied to an empty set, the whole log
+    bool reset(const VersionEdit& edit);
+    // Appends edit and applies it to files()
+    bool log_and_apply(const VersionEdit& edit);
+
+    // Live tables by file number, so oldest first
+    const std::map<uint64_t, FileMetaData>& files() const;
+    uint64_t next_file_number() const;
+
+    static constexpr uint64_t kMaxLogSize = 4 * 1024 * 1024;
+
+private:
+    std::string filename_;
+    std::ofstream log_;
+    uint64_t log_size_;
+    std::map<uint64_t, FileMetaData> files_;
+    uint64_t next_file_number_;
+
+    void apply(const VersionEdit& edit);
+    bool write_snapshot();
+    // Writes and syncs one record to out, which is open on filename
+    static bool append(std::ofstream& out, const std::string& filename, const VersionEdit& edit,
+                       uint64_t& log_size);
+};
@@ -8,8 +8,10 @@ void print_usage() {
     std::cout << "  put <key> <value> - Store a key-value pair\\n";
     std::cout << "  get <key>         - Retrieve value for key\\n";
     std::cout << "  del <key>         - Delete key\\n";
+    std::cout << "  scan [prefix]     - List keys in order, optionally by prefix\n";
     std::cout << "  flush             - Flush memtable to disk\\n";
     std::cout << "  snapshot          - Create snapshot\\n";
+    std::cout << "  stats             - Show counters and latencies\\n";
     std::cout << "  quit              - Exit\\n";
 }
 
@@ -71,9 +73,24 @@ int main() {
                     std::cout << "Error: Failed to delete\\n";
                 }
             }
+        } else if (cmd == "scan") {
+            ReadOptions options;
+            iss >> options.prefix;
+            auto it = store.new_iterator(options);
+            for (it->seek_to_first(); it->valid(); it->next()) {
+                std::cout << it->key() << " = " << it->value() << "\n";
+            }
         } else if (cmd == "flush") {
             store.flush_memtable();
             std::cout << "Memtable flushed\\n";
+        } else if (cmd == "stats") {
+            std::cout << store.get_stats().to_string();
+            for (int level = 0; level < Options().num_levels; ++level) {
+                size_t tables = store.num_tables_at_level(level);
+                if (tables > 0) {
+                    std::cout << "L" << level << " tables: " << tables << "\n";
+                }
+            }
         } else if (cmd == "snapshot") {
             if (store.create_snapshot()) {
                 std::cout << "Snapshot created\\n";
@@ -0,0 +1,261 @@
+#include "memtable.hpp"
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <random>
+#include <thread>
+
+// Skip list node, allocated in the arena with room for `height` next
+// pointers. The key never changes once the node is linked in.
+struct MemTable::Node {
+    std::atomic<const char*> record;  // [deleted u8][value_len u32][value]
+    const char* key_data;
+    uint32_t key_size;
+    uint64_t sequence;
+    std::atomic<Node*> next_[1];  // really `height` entries
+
+    std::string_view key() const { return std::string_view(key_data, key_size); }
+
+    // Orders by key, then newest first
+    int compare(std::string_view k, uint64_t seq) const {
+        int cmp = key().compare(k);
+        if (cmp != 0) return cmp;
+        return sequence > seq ? -1 : (sequence < seq ? 1 : 0);
+    }
+
+    Node* next(int level) const { return next_[level].load(std::memory_order_acquire); }
+};
+
+namespace {
+
+constexpr size_t kRecordHeader = sizeof(uint8_t) + sizeof(uint32_t);
+
+bool record_deleted(const char* record) {
+    return record[0] != 0;
+}
+
+std::string_view record_value(const char* record) {
+    uint32_t size;
+    std::memcpy(&size, record + 1, sizeof(size));
+    return std::string_view(record + kRecordHeader, size);
+}
+
+}
+
+MemTable::MemTable(size_t arena_block_size) : arena_(arena_block_size), max_height_(1) {
+    head_ = new_node(std::string_view(), 0, nullptr, kMaxHeight);
+}
+
+void MemTable::put(std::string_view key, std::string_view value, uint64_t sequence) {
+    insert(key, sequence, new_record(value, false));
+}
+
+void MemTable::remove(std::string_view key, uint64_t sequence) {
+    insert(key, sequence, new_record(std::string_view(), true));
+}
+
+LookupResult MemTable::get(std::string_view key, std::string& value, uint64_t snapshot) const {
+    // The first entry at or after (key, snapshot) is the newest visible version
+    Node* node = find_greater_or_equal(key, snapshot);
+    if (node == nullptr || node->key() != key) {
+        return LookupResult::NOT_FOUND;
+    }
+    const char* record = node->record.load(std::memory_order_acquire);
+    if (record_deleted(record)) {
+        return LookupResult::DELETED;
+    }
+    value.assign(record_value(record));
+    return LookupResult::FOUND;
+}
+
+bool MemTable::empty() const {
+    return head_->next(0) == nullptr;
+}
+
+size_t MemTable::approximate_size() const {
+    return arena_.memory_usage();
+}
+
+void MemTable::insert(std::string_view key, uint64_t sequence, const char* record) {
+    // Find the neighbours of (key, sequence) on every level
+    Node* prev[kMaxHeight];
+    Node* next[kMaxHeight];
+    Node* x = head_;
+    for (int level = kMaxHeight - 1; level >= 0; --level) {
+        Node* n = x->next(level);
+        while (n != nullptr && n->compare(key, sequence) < 0) {
+            x = n;
+            n = x->next(level);
+        }
+        prev[level] = x;
+        next[level] = n;
+    }
+
+    if (next[0] != nullptr && next[0]->compare(key, sequence) == 0) {
+        next[0]->record.store(record, std::memory_order_release);
+        return;
+    }
+
+    int height = random_height();
+    Node* node = new_node(key, sequence, record, height);
+    int max_height = max_height_.load(std::memory_order_relaxed);
+    while (height > max_height &&
+           !max_height_.compare_exchange_weak(max_height, height, std::memory_order_relaxed)) {
+    }
+
+    // Link bottom-up; a node is in the table once level 0 points at it. If
+    // another writer got in between, search again from the old predecessor.
+    for (int level = 0; level < height; ++level) {
+        while (true) {
+            node->next_[level].store(next[level], std::memory_order_relaxed);
+            if (prev[level]->next_[level].compare_exchange_strong(next[level], node,
+                                                                  std::memory_order_release)) {
+                break;
+            }
+            Node* x = prev[level];
+            Node* n = x->next(level);
+            while (n != nullptr && n->compare(key, sequence) < 0) {
+                x = n;
+                n = x->next(level);
+            }
+            prev[level] = x;
+            next[level] = n;
+
+            // Someone else inserted the same entry first; overwrite theirs
+            if (level == 0 && n != nullptr && n->compare(key, sequence) == 0) {
+                n->record.store(record, std::memory_order_release);
+                return;
+            }
+        }
+    }
+}
+
+const char* MemTable::new_record(std::string_view value, bool deleted) {
+    char* record = arena_.allocate(kRecordHeader + value.size());
+    uint32_t size = static_cast<uint32_t>(value.size());
+    record[0] = deleted ? 1 : 0;
+    std::memcpy(record + 1, &size, sizeof(size));
+    std::memcpy(record + kRecordHeader, value.data(), value.size());
+    return record;
+}
+
+MemTable::Node* MemTable::new_node(std::string_view key, uint64_t sequence, const char* record,
+                                   int height) {
+    size_t bytes = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+    char* mem = arena_.allocate(bytes + key.size());
+    Node* node = new (mem) Node;
+    for (int level = 1; level < height; ++level) {
+        new (&node->next_[level]) std::atomic<Node*>();
+    }
+    for (int level = 0; level < height; ++level) {
+        node->next_[level].store(nullptr, std::memory_order_relaxed);
+    }
+
+    char* key_data = mem + bytes;
+    std::memcpy(key_data, key.data(), key.size());
+    node->key_data = key_data;
+    node->key_size = static_cast<uint32_t>(key.size());
+    node->sequence = sequence;
+    node->record.store(record, std::memory_order_relaxed);
+    return node;
+}
+
+int MemTable::random_height() {
+    // Each level up is four times sparser, as in LevelDB
+    thread_local std::minstd_rand rng(
+        static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+    int height = 1;
+    while (height < kMaxHeight && rng() % 4 == 0) {
+        ++height;
+    }
+    return height;
+}
+
+MemTable::Node* MemTable::find_greater_or_equal(std::string_view key, uint64_t sequence) const {
+    Node* x = head_;
+    int level = max_height_.load(std::memory_order_relaxed) - 1;
+    while (true) {
+        Node* n = x->next(level);
+        if (n != nullptr && n->compare(key, sequence) < 0) {
+            x = n;
+        } else if (level == 0) {
+            return n;
+        } else {
+            --level;
+        }
+    }
+}
+
+MemTable::Node* MemTable::find_less_than(std::string_view key, uint64_t sequence) const {
+    Node* x = head_;
+    int level = max_height_.load(std::memory_order_relaxed) - 1;
+    while (true) {
+        Node* n = x->next(level);
+        if (n != nullptr && n->compare(key, sequence) < 0) {
+            x = n;
+        } else if (level == 0) {
+            return x == head_ ? nullptr : x;
+        } else {
+            --level;
+        }
+    }
+}
+
+MemTable::Node* MemTable::find_last() const {
+    Node* x = head_;
+    int level = max_height_.load(std::memory_order_relaxed) - 1;
+    while (true) {
+        Node* n = x->next(level);
+        if (n != nullptr) {
+            x = n;
+        } else if (level == 0) {
+            return x == head_ ? nullptr : x;
+        } else {
+            --level;
+        }
+    }
+}
+
+MemTable::Iterator::Iterator(const MemTable* mem) : mem_(mem), node_(nullptr) {
+}
+
+void MemTable::Iterator::seek_to_first() {
+    node_ = mem_->head_->next(0);
+}
+
+void MemTable::Iterator::seek_to_last() {
+    node_ = mem_->find_last();
+}
+
+void MemTable::Iterator::seek(std::string_view key) {
+    node_ = mem_->find_greater_or_equal(key, kMaxSequence);
+}
+
+bool MemTable::Iterator::valid() const {
+    return node_ != nullptr;
+}
+
+void MemTable::Iterator::next() {
+    node_ = node_->next(0);
+}
+
+void MemTable::Iterator::prev() {
+    // No back pointers: search for the predecessor instead
+    node_ = mem_->find_less_than(node_->key(), node_->sequence);
+}
+
+std::string_view MemTable::Iterator::key() const {
+    return node_->key();
+}
+
+uint64_t MemTable::Iterator::sequence() const {
+    return node_->sequence;
+}
+
+std::string_view MemTable::Iterator::value() const {
+    return record_value(node_->record.load(std::memory_order_acquire));
+}
+
+bool MemTable::Iterator::deleted() const {
+    return record_deleted(node_->record.load(std::memory_order_acquire));
+}
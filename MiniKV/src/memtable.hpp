@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+#include "arena.hpp"
+
+// Result of a point lookup in one layer of the store. DELETED means the layer
+// holds a tombstone, which hides any older value further down; BLOB_INDEX
+// means the value found is a pointer into a blob file.
+enum class LookupResult { NOT_FOUND, FOUND, DELETED, BLOB_INDEX };
+
+// Every write is tagged with a sequence number; reading "as of" a sequence
+// ignores anything newer. Sequences fit in 56 bits so SSTables can pack them
+// with the entry type into one u64.
+constexpr uint64_t kMaxSequence = (1ULL << 56) - 1;
+
+// Sorted in-memory buffer of recent writes. Deletes are kept as tombstones
+// so they shadow values in older memtables and SSTables. Each (key, sequence)
+// is its own entry, ordered by key and then newest first, so older versions
+// stay readable for snapshots.
+//
+// Entries live in a skip list whose nodes, keys and values are all carved
+// out of an arena. Writers link nodes in with compare-and-swap and readers
+// take no locks, so get() and iteration can run alongside put(). Writing the
+// same key and sequence twice swaps the node's value pointer; the old value
+// stays in the arena until the memtable is destroyed.
+class MemTable {
+    struct Node;
+
+public:
+    explicit MemTable(size_t arena_block_size = Arena::kDefaultBlockSize);
+    MemTable(const MemTable&) = delete;
+    MemTable& operator=(const MemTable&) = delete;
+
+    void put(std::string_view key, std::string_view value, uint64_t sequence = 0);
+    void remove(std::string_view key, uint64_t sequence = 0);
+    // Looks up the newest version of key no newer than snapshot
+    LookupResult get(std::string_view key, std::string& value,
+                     uint64_t snapshot = kMaxSequence) const;
+
+    bool empty() const;
+    // Arena bytes held, so overwritten values and node overhead count too
+    size_t approximate_size() const;
+
+    // Walks entries in key order, newest version first, tombstones included.
+    // Entries added while iterating may or may not be seen.
+    class Iterator {
+    public:
+        explicit Iterator(const MemTable* mem);
+
+        void seek_to_first();
+        void seek_to_last();
+        void seek(std::string_view key);
+        bool valid() const;
+        void next();
+        void prev();
+
+        std::string_view key() const;
+        uint64_t sequence() const;
+        std::string_view value() const;
+        bool deleted() const;
+
+    private:
+        const MemTable* mem_;
+        const Node* node_;
+    };
+
+private:
+    static constexpr int kMaxHeight = 12;
+
+    Arena arena_;
+    Node* head_;
+    std::atomic<int> max_height_;  // height of the tallest node, a hint for searches
+
+    void insert(std::string_view key, uint64_t sequence, const char* record);
+    const char* new_record(std::string_view value, bool deleted);
+    Node* new_node(std::string_view key, uint64_t sequence, const char* record, int height);
+    static int random_height();
+
+    Node* find_greater_or_equal(std::string_view key, uint64_t sequence) const;
+    Node* find_less_than(std::string_view key, uint64_t sequence) const;
+    Node* find_last() const;
+};
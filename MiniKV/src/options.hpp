@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include "compression.hpp"
+
+class BlockCache;
+class Statistics;
+class Snapshot;
+
+// Tunables shared by KVStore and the SSTables it creates
+struct Options {
+    // Memtable size that triggers a flush to a new SSTable
+    size_t memtable_size_limit = 1024 * 1024;
+
+    // Target size of an SSTable data block; the index keeps one key per block
+    size_t block_size = 4096;
+
+    // Keys in a data block are stored as a suffix of the previous key; every
+    // this many entries one is stored whole so lookups can binary-search
+    int block_restart_interval = 16;
+
+    // Codec id for new data blocks, see compression.hpp; kNoCompression
+    // turns it off. Blocks that don't shrink are stored as is either way.
+    uint8_t compression = kLZCompression;
+
+    // Space reserved up front for each WAL segment, so appends don't grow
+    // the file and a sync has no metadata to write; 0 reserves the memtable
+    // size limit, about what a segment holds before the memtable switches
+    size_t wal_segment_size = 0;
+
+    // Flushed WAL segments kept to be reused as later segments rather than
+    // deleted and allocated again
+    size_t wal_recycle_limit = 4;
+
+    // Threads that open tables and replay WAL segments when the store
+    // opens; 0 uses one per core
+    int max_open_threads = 0;
+
+    // Map SSTable files once and decode lookups straight from the mapping
+    // instead of opening a stream per read
+    bool use_mmap_reads = true;
+
+    // Byte budget of the block cache KVStore creates when block_cache is unset;
+    // 0 disables caching
+    size_t block_cache_size = 8 * 1024 * 1024;
+
+    // Cache shared by all SSTables opened with these options
+    std::shared_ptr<BlockCache> block_cache;
+
+    // Counters and latency histograms; KVStore creates one when unset. Stores
+    // given the same object add to the same totals.
+    std::shared_ptr<Statistics> statistics;
+
+    // Bloom filter bits per key written into each SSTable; 0 disables filters
+    int bloom_bits_per_key = 10;
+
+    // Leveled compaction: L0 is merged into L1 once it holds this many
+    // tables, and writes stall while it holds l0_stop_writes_trigger
+    int l0_compaction_trigger = 4;
+    int l0_stop_writes_trigger = 12;
+
+    // Size target of L1; every deeper level is level_size_multiplier times larger
+    size_t max_bytes_for_level_base = 10 * 1024 * 1024;
+    int level_size_multiplier = 10;
+    int num_levels = 7;
+
+    // Compaction output is split into tables of about this size
+    size_t target_file_size = 2 * 1024 * 1024;
+
+    // Values of at least this many bytes are written once, to a blob file,
+    // when their memtable is flushed; tables only hold pointers to them, so
+    // compaction never copies them again. 0 keeps every value in the tables.
+    size_t min_blob_size = 0;
+
+    // A blob file is garbage collected once this fraction of its bytes is
+    // no longer pointed at: the rest is copied to a new file and the tables
+    // pointing into it are rewritten
+    double blob_gc_threshold = 0.5;
+};
+
+// Per-read settings for KVStore::get and KVStore::new_iterator
+struct ReadOptions {
+    // Read the store as it was when this snapshot was taken; unset reads the
+    // latest state
+    std::shared_ptr<const Snapshot> snapshot;
+
+    // Only keys starting with this prefix are visible
+    std::string prefix;
+
+    // Exclusive upper bound on visible keys; empty means unbounded
+    std::string upper_bound;
+
+    // Whether blocks read by the scan are added to the block cache; bulk
+    // scans should turn this off so they don't evict the hot set
+    bool fill_cache = true;
+};
@@ -0,0 +1,128 @@
+#include "resp.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// Bounds what a client can make us buffer for a single command; a bulk
+// string is no longer than the server's input buffer limit
+constexpr int64_t kMaxArgs = 1024 * 1024;
+constexpr int64_t kMaxBulkLength = 64 * 1024 * 1024;
+constexpr size_t kMaxInlineLength = 64 * 1024;
+
+// Reads "<integer>\r\n" starting at pos
+resp::ParseResult parse_line_integer(std::string_view buf, size_t& pos, int64_t& value) {
+    size_t end = buf.find("\r\n", pos);
+    if (end == std::string_view::npos) {
+        return buf.size() - pos > 32 ? resp::ParseResult::ERROR : resp::ParseResult::INCOMPLETE;
+    }
+    std::string_view digits = buf.substr(pos, end - pos);
+    bool negative = !digits.empty() && digits[0] == '-';
+    if (negative) digits.remove_prefix(1);
+    if (digits.empty() || digits.size() > 18) return resp::ParseResult::ERROR;
+    value = 0;
+    for (char c : digits) {
+        if (!std::isdigit(static_cast<unsigned char>(c))) return resp::ParseResult::ERROR;
+        value = value * 10 + (c - '0');
+    }
+    if (negative) value = -value;
+    pos = end + 2;
+    return resp::ParseResult::OK;
+}
+
+resp::ParseResult parse_inline(std::string_view buf, size_t& consumed, std::vector<std::string>& args) {
+    size_t end = buf.find('\n');
+    if (end == std::string_view::npos) {
+        return buf.size() > kMaxInlineLength ? resp::ParseResult::ERROR : resp::ParseResult::INCOMPLETE;
+    }
+    std::string_view line = buf.substr(0, end);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+    args.clear();
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && line[i] == ' ') ++i;
+        size_t start = i;
+        while (i < line.size() && line[i] != ' ') ++i;
+        if (i > start) args.emplace_back(line.substr(start, i - start));
+    }
+    consumed = end + 1;
+    return resp::ParseResult::OK;
+}
+
+}
+
+namespace resp {
+
+ParseResult parse_command(std::string_view buf, size_t& consumed, std::vector<std::string>& args) {
+    if (buf.empty()) {
+        return ParseResult::INCOMPLETE;
+    }
+    if (buf[0] != '*') {
+        return parse_inline(buf, consumed, args);
+    }
+
+    size_t pos = 1;
+    int64_t count;
+    ParseResult result = parse_line_integer(buf, pos, count);
+    if (result != ParseResult::OK) return result;
+    if (count < 0 || count > kMaxArgs) return ParseResult::ERROR;
+
+    // Parse into a scratch vector so a partial command leaves args alone
+    std::vector<std::string> parsed;
+    parsed.reserve(static_cast<size_t>(std::min<int64_t>(count, 64)));
+    for (int64_t i = 0; i < count; ++i) {
+        if (pos >= buf.size()) return ParseResult::INCOMPLETE;
+        if (buf[pos] != '$') return ParseResult::ERROR;
+        ++pos;
+        int64_t len;
+        result = parse_line_integer(buf, pos, len);
+        if (result != ParseResult::OK) return result;
+        if (len < 0 || len > kMaxBulkLength) return ParseResult::ERROR;
+        if (buf.size() - pos < static_cast<size_t>(len) + 2) return ParseResult::INCOMPLETE;
+        if (buf.compare(pos + len, 2, "\r\n") != 0) return ParseResult::ERROR;
+        parsed.emplace_back(buf.substr(pos, len));
+        pos += len + 2;
+    }
+    args.swap(parsed);
+    consumed = pos;
+    return ParseResult::OK;
+}
+
+void append_simple(std::string& out, std::string_view s) {
+    out.push_back('+');
+    out.append(s);
+    out.append("\r\n");
+}
+
+void append_error(std::string& out, std::string_view message) {
+    out.push_back('-');
+    out.append(message);
+    out.append("\r\n");
+}
+
+void append_integer(std::string& out, int64_t value) {
+    out.push_back(':');
+    out.append(std::to_string(value));
+    out.append("\r\n");
+}
+
+void append_bulk(std::string& out, std::string_view s) {
+    out.push_back('$');
+    out.append(std::to_string(s.size()));
+    out.append("\r\n");
+    out.append(s);
+    out.append("\r\n");
+}
+
+void append_null(std::string& out) {
+    out.append("$-1\r\n");
+}
+
+void append_array(std::string& out, size_t count) {
+    out.push_back('*');
+    out.append(std::to_string(count));
+    out.append("\r\n");
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Redis serialization protocol (RESP2), as far as minikv-server needs it:
+// parsing client commands and encoding replies.
+namespace resp {
+    enum class ParseResult { OK, INCOMPLETE, ERROR };
+
+    // Parses one command from the front of buf: an array of bulk strings, or
+    // an inline command line as typed into telnet. On OK, args holds the
+    // command and consumed the bytes it took.
+    ParseResult parse_command(std::string_view buf, size_t& consumed, std::vector<std::string>& args);
+
+    void append_simple(std::string& out, std::string_view s);
+    void append_error(std::string& out, std::string_view message);
+    void append_integer(std::string& out, int64_t value);
+    void append_bulk(std::string& out, std::string_view s);
+    void append_null(std::string& out);
+    void append_array(std::string& out, size_t count);
+}
@@ -0,0 +1,485 @@
+#include "server.hpp"
+#include "sharded_kvstore.hpp"
+#include "write_batch.hpp"
+#include "resp.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <set>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Storage has no length limit of its own; these keep one command well
+// under the input buffer limit
+constexpr size_t kMaxKeySize = 1024 * 1024;
+constexpr size_t kMaxValueSize = 32 * 1024 * 1024;
+
+// A client that sends more than this without completing a command is told
+// so and dropped
+constexpr size_t kMaxInputBuffer = 64 * 1024 * 1024;
+// Stop reading from a client while this much of its output is unsent
+constexpr size_t kMaxPendingOutput = 4 * 1024 * 1024;
+// Largest run of pipelined writes applied as one batch
+constexpr size_t kMaxBatchOps = 1024;
+
+std::string to_upper(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    return s;
+}
+
+// SCAN cursors are the next key to return, hex encoded so that "0" (start
+// and end of a scan in Redis) never collides with one
+std::string hex_encode(std::string_view s) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : s) {
+        out.push_back(digits[c >> 4]);
+        out.push_back(digits[c & 0x0f]);
+    }
+    return out;
+}
+
+bool hex_decode(const std::string& s, std::string& out) {
+    auto nibble = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    if (s.size() % 2 != 0) return false;
+    out.clear();
+    for (size_t i = 0; i < s.size(); i += 2) {
+        int hi = nibble(s[i]), lo = nibble(s[i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out.push_back(static_cast<char>(hi << 4 | lo));
+    }
+    return true;
+}
+
+void wrong_arity(std::string& out, const std::string& command) {
+    std::string name = command;
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    resp::append_error(out, "ERR wrong number of arguments for '" + name + "' command");
+}
+
+}
+
+struct Server::PendingWrites {
+    WriteBatch batch;
+    std::string replies;  // sent once the batch is written
+    size_t count = 0;
+};
+
+Server::Server(ShardedKVStore& store, const ServerOptions& options)
+    : store_(store), options_(options), epoll_fd_(-1), port_(0), stopping_(false) {
+}
+
+Server::~Server() {
+    stop();
+}
+
+bool Server::start() {
+    listener_.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener_.fd < 0) {
+        return false;
+    }
+    int one = 1;
+    ::setsockopt(listener_.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options_.port);
+    socklen_t addr_len = sizeof(addr);
+    if (::inet_pton(AF_INET, options_.host.c_str(), &addr.sin_addr) != 1 ||
+        ::bind(listener_.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listener_.fd, SOMAXCONN) != 0 ||
+        ::getsockname(listener_.fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+        return false;
+    }
+    port_ = ntohs(addr.sin_port);
+
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    waker_.fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || waker_.fd < 0) {
+        return false;
+    }
+
+    // The waker is level-triggered so one write wakes every worker
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &waker_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, waker_.fd, &ev) != 0) {
+        return false;
+    }
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = &listener_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listener_.fd, &ev) != 0) {
+        return false;
+    }
+
+    for (int i = 0; i < std::max(options_.num_workers, 1); ++i) {
+        workers_.emplace_back(&Server::run_worker, this);
+    }
+    return true;
+}
+
+void Server::stop() {
+    if (stopping_.exchange(true)) {
+        return;
+    }
+    if (waker_.fd >= 0) {
+        uint64_t one = 1;
+        ssize_t n = ::write(waker_.fd, &one, sizeof(one));
+        (void)n;
+    }
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+
+    // Workers are gone, so nothing else touches the connections
+    for (Connection* conn : connections_) {
+        ::close(conn->fd);
+        delete conn;
+    }
+    connections_.clear();
+    for (int* fd : {&listener_.fd, &waker_.fd, &epoll_fd_}) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+uint16_t Server::port() const {
+    return port_;
+}
+
+void Server::run_worker() {
+    epoll_event events[64];
+    while (!stopping_.load()) {
+        int n = ::epoll_wait(epoll_fd_, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n && !stopping_.load(); ++i) {
+            auto* conn = static_cast<Connection*>(events[i].data.ptr);
+            if (conn == &waker_) {
+                continue;
+            }
+            if (conn == &listener_) {
+                accept_connections();
+            } else {
+                handle_event(conn, events[i].events);
+            }
+        }
+    }
+}
+
+void Server::accept_connections() {
+    while (true) {
+        int fd = ::accept4(listener_.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;  // EAGAIN once drained; on other errors retry on the next wakeup
+        }
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto* conn = new Connection;
+        conn->fd = fd;
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            connections_.insert(conn);
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close_connection(conn);
+        }
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = &listener_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, listener_.fd, &ev);
+}
+
+void Server::handle_event(Connection* conn, uint32_t events) {
+    bool ok = !(events & EPOLLERR);
+    if (ok && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+        ok = read_input(conn);
+    }
+    if (ok) {
+        process_input(conn);
+        ok = write_output(conn);
+    }
+    if (!ok || (conn->closing && conn->out.empty())) {
+        close_connection(conn);
+        return;
+    }
+
+    // Re-arm: keep reading unless the client is gone or not reading replies
+    epoll_event ev{};
+    ev.events = EPOLLONESHOT;
+    if (!conn->closing) ev.events |= EPOLLRDHUP;
+    if (!conn->closing && conn->out.size() < kMaxPendingOutput) ev.events |= EPOLLIN;
+    if (!conn->out.empty()) ev.events |= EPOLLOUT;
+    ev.data.ptr = conn;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &ev) != 0) {
+        close_connection(conn);
+    }
+}
+
+void Server::close_connection(Connection* conn) {
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    ::close(conn->fd);
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_.erase(conn);
+    }
+    delete conn;
+}
+
+bool Server::read_input(Connection* conn) {
+    char buffer[16384];
+    while (true) {
+        ssize_t n = ::read(conn->fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            conn->in.append(buffer, n);
+            if (conn->in.size() > kMaxInputBuffer) return true;  // process_input refuses it
+        } else if (n == 0) {
+            conn->closing = true;  // answer what was sent, then close
+            return true;
+        } else if (errno != EINTR) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+}
+
+bool Server::write_output(Connection* conn) {
+    size_t sent = 0;
+    while (sent < conn->out.size()) {
+        ssize_t n = ::send(conn->fd, conn->out.data() + sent, conn->out.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    conn->out.erase(0, sent);
+    return true;
+}
+
+void Server::process_input(Connection* conn) {
+    // Everything complete in the input is one pipeline; runs of writes in
+    // it are batched until a read or the end of the pipeline
+    PendingWrites pending;
+    std::vector<std::string> args;
+    size_t pos = 0;
+    while (pos < conn->in.size()) {
+        size_t consumed = 0;
+        auto result = resp::parse_command(std::string_view(conn->in).substr(pos), consumed, args);
+        if (result == resp::ParseResult::INCOMPLETE) {
+            break;
+        }
+        if (result == resp::ParseResult::ERROR) {
+            flush_writes(pending, conn->out);
+            resp::append_error(conn->out, "ERR Protocol error");
+            conn->closing = true;
+            pos = conn->in.size();
+            break;
+        }
+        pos += consumed;
+        if (!args.empty() && !execute(args, pending, conn)) {
+            conn->closing = true;
+            pos = conn->in.size();  // ignore anything sent after QUIT
+            break;
+        }
+    }
+    flush_writes(pending, conn->out);
+    conn->in.erase(0, pos);
+    if (conn->in.size() > kMaxInputBuffer) {
+        resp::append_error(conn->out, "ERR command too large");
+        conn->closing = true;
+        conn->in.clear();
+    }
+}
+
+void Server::flush_writes(PendingWrites& pending, std::string& out) {
+    if (pending.count == 0) {
+        return;
+    }
+    if (store_.write(pending.batch)) {
+        out.append(pending.replies);
+    } else {
+        for (size_t i = 0; i < pending.count; ++i) {
+            resp::append_error(out, "ERR write failed");
+        }
+    }
+    pending.batch.clear();
+    pending.replies.clear();
+    pending.count = 0;
+}
+
+bool Server::execute(const std::vector<std::string>& args, PendingWrites& pending, Connection* conn) {
+    std::string command = to_upper(args[0]);
+    std::string& out = conn->out;
+
+    if (command == "SET") {
+        if (args.size() != 3) {
+            flush_writes(pending, out);
+            wrong_arity(out, command);
+        } else if (args[1].size() > kMaxKeySize || args[2].size() > kMaxValueSize) {
+            flush_writes(pending, out);
+            resp::append_error(out, "ERR key or value too large");
+        } else {
+            pending.batch.put(args[1], args[2]);
+            resp::append_simple(pending.replies, "OK");
+            if (++pending.count >= kMaxBatchOps) flush_writes(pending, out);
+        }
+        return true;
+    }
+
+    if (command == "DEL") {
+        // Count keys that exist after the writes before this one; only
+        // those need a tombstone
+        flush_writes(pending, out);
+        if (args.size() < 2) {
+            wrong_arity(out, command);
+            return true;
+        }
+        std::set<std::string> seen;
+        std::string value;
+        int64_t removed = 0;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (seen.insert(args[i]).second && store_.get(args[i], value)) {
+                pending.batch.remove(args[i]);
+                ++removed;
+            }
+        }
+        resp::append_integer(pending.replies, removed);
+        if (++pending.count >= kMaxBatchOps) flush_writes(pending, out);
+        return true;
+    }
+
+    // Everything else replies right away, after the writes queued before it
+    flush_writes(pending, out);
+    std::string value;
+    if (command == "GET") {
+        if (args.size() != 2) {
+            wrong_arity(out, command);
+        } else if (store_.get(args[1], value)) {
+            resp::append_bulk(out, value);
+        } else {
+            resp::append_null(out);
+        }
+    } else if (command == "MGET") {
+        if (args.size() < 2) {
+            wrong_arity(out, command);
+            return true;
+        }
+        std::vector<std::string> keys(args.begin() + 1, args.end());
+        resp::append_array(out, keys.size());
+        for (const auto& found : store_.multi_get(keys)) {
+            if (found) {
+                resp::append_bulk(out, *found);
+            } else {
+                resp::append_null(out);
+            }
+        }
+    } else if (command == "SCAN") {
+        scan(args, out);
+    } else if (command == "PING") {
+        if (args.size() > 2) {
+            wrong_arity(out, command);
+        } else if (args.size() == 2) {
+            resp::append_bulk(out, args[1]);
+        } else {
+            resp::append_simple(out, "PONG");
+        }
+    } else if (command == "ECHO") {
+        if (args.size() != 2) {
+            wrong_arity(out, command);
+        } else {
+            resp::append_bulk(out, args[1]);
+        }
+    } else if (command == "QUIT") {
+        resp::append_simple(out, "OK");
+        return false;
+    } else if (command == "COMMAND" || command == "CONFIG") {
+        // Clients probe these on connect; an empty answer satisfies them
+        resp::append_array(out, 0);
+    } else {
+        resp::append_error(out, "ERR unknown command '" + args[0] + "'");
+    }
+    return true;
+}
+
+void Server::scan(const std::vector<std::string>& args, std::string& out) {
+    // SCAN cursor [MATCH pattern] [COUNT count]
+    if (args.size() < 2 || args.size() % 2 != 0) {
+        wrong_arity(out, "SCAN");
+        return;
+    }
+    std::string resume;
+    if (args[1] != "0" && !hex_decode(args[1], resume)) {
+        resp::append_error(out, "ERR invalid cursor");
+        return;
+    }
+
+    ReadOptions options;
+    options.fill_cache = false;
+    size_t count = 10;
+    for (size_t i = 2; i < args.size(); i += 2) {
+        std::string option = to_upper(args[i]);
+        const std::string& arg = args[i + 1];
+        if (option == "MATCH") {
+            // Keys are only ordered, not indexed by pattern, so only prefixes
+            std::string prefix = arg.substr(0, arg.size() - 1);
+            if (arg.empty() || arg.back() != '*' || prefix.find_first_of("*?[\\") != std::string::npos) {
+                resp::append_error(out, "ERR only prefix patterns like 'abc*' are supported");
+                return;
+            }
+            options.prefix = prefix;
+        } else if (option == "COUNT") {
+            if (arg.empty() || arg.size() > 9 ||
+                !std::all_of(arg.begin(), arg.end(), ::isdigit) || std::stoul(arg) == 0) {
+                resp::append_error(out, "ERR value is not an integer or out of range");
+                return;
+            }
+            count = std::stoul(arg);
+        } else {
+            resp::append_error(out, "ERR syntax error");
+            return;
+        }
+    }
+
+    auto it = store_.new_iterator(options);
+    std::vector<std::string> keys;
+    for (it->seek(resume); it->valid() && keys.size() < count; it->next()) {
+        keys.emplace_back(it->key());
+    }
+
+    resp::append_array(out, 2);
+    resp::append_bulk(out, it->valid() ? hex_encode(it->key()) : "0");
+    resp::append_array(out, keys.size());
+    for (const auto& key : keys) {
+        resp::append_bulk(out, key);
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+class ShardedKVStore;
+class WriteBatch;
+
+struct ServerOptions {
+    std::string host = "127.0.0.1";
+    uint16_t port = 6380;  // 0 picks a free port; see Server::port()
+    int num_workers = 4;
+};
+
+// RESP server for a ShardedKVStore, answering GET, SET, DEL, MGET and SCAN
+// (plus PING, ECHO, QUIT and enough of COMMAND and CONFIG for stock Redis
+// tools). Every worker thread waits on one shared epoll set; sockets are
+// registered one-shot, so each connection is served by one worker at a
+// time and needs no locking.
+//
+// A pipelined run of SET and DEL commands is applied as one WriteBatch.
+// Reads flush the pending batch first, so replies match running the
+// commands one by one.
+class Server {
+public:
+    Server(ShardedKVStore& store, const ServerOptions& options = ServerOptions());
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Binds, listens and starts the workers
+    bool start();
+    // Stops the workers and closes every connection
+    void stop();
+
+    // The port actually bound, once started
+    uint16_t port() const;
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::string in;
+        std::string out;
+        bool closing = false;  // close once out is flushed
+    };
+
+    // Consecutive SET/DEL commands waiting to be written as one batch
+    struct PendingWrites;
+
+    ShardedKVStore& store_;
+    ServerOptions options_;
+    int epoll_fd_;
+    Connection listener_;  // registered like a connection, told apart by address
+    Connection waker_;     // eventfd that stop() makes readable to every worker
+    uint16_t port_;
+    std::atomic<bool> stopping_;
+    std::vector<std::thread> workers_;
+
+    std::mutex connections_mutex_;
+    std::unordered_set<Connection*> connections_;
+
+    void run_worker();
+    void accept_connections();
+    void handle_event(Connection* conn, uint32_t events);
+    void close_connection(Connection* conn);
+    bool read_input(Connection* conn);
+    bool write_output(Connection* conn);
+
+    void process_input(Connection* conn);
+    // Returns false once the client asked to disconnect
+    bool execute(const std::vector<std::string>& args, PendingWrites& pending, Connection* conn);
+    void flush_writes(PendingWrites& pending, std::string& out);
+    void scan(const std::vector<std::string>& args, std::string& out);
+};
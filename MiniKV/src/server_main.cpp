@@ -0,0 +1,68 @@
+#include "server.hpp"
+#include "sharded_kvstore.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <pthread.h>
+
+void print_usage() {
+    std::cout << "Usage: minikv-server [options]\n";
+    std::cout << "  --host <addr>     Address to listen on (default 127.0.0.1)\n";
+    std::cout << "  --port <port>     Port to listen on (default 6380)\n";
+    std::cout << "  --workers <n>     Worker threads (default 4)\n";
+    std::cout << "  --shards <n>      Store shards, for a new store (default 4)\n";
+    std::cout << "  --dir <path>      Data directory (default ./minikv_server_data)\n";
+}
+
+int main(int argc, char** argv) {
+    ServerOptions options;
+    std::string data_dir = "./minikv_server_data";
+    size_t shards = 4;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            print_usage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--host") {
+            options.host = value;
+        } else if (arg == "--port") {
+            options.port = static_cast<uint16_t>(std::atoi(value.c_str()));
+        } else if (arg == "--workers") {
+            options.num_workers = std::atoi(value.c_str());
+        } else if (arg == "--shards") {
+            shards = static_cast<size_t>(std::atoi(value.c_str()));
+        } else if (arg == "--dir") {
+            data_dir = value;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    // Handle shutdown signals on this thread only; the workers inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    ShardedKVStore store(data_dir, shards);
+    Server server(store, options);
+    if (!server.start()) {
+        std::cerr << "minikv-server: cannot listen on " << options.host << ":" << options.port << "\n";
+        return 1;
+    }
+    std::cout << "minikv-server listening on " << options.host << ":" << server.port()
+              << " with " << store.num_shards() << " shards\n";
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    std::cout << "minikv-server shutting down\n";
+    server.stop();
+    return 0;
+}
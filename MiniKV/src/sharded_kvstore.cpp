@@ -0,0 +1,256 @@
+#include "sharded_kvstore.hpp"
+#include "iterator.hpp"
+#include "write_batch.hpp"
+#include "cache.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <thread>
+
+namespace {
+
+// Fixed seed: the hash decides which directory a key lives in, so it must
+// never change between runs
+constexpr uint32_t kShardSeed = 0x5eed5a4d;
+
+// Presents a shard's scan to MergingIterator. Shards hold disjoint keys and
+// already hide tombstones and read blob values, so every entry is a live
+// value.
+class ShardIterator : public InternalIterator {
+public:
+    explicit ShardIterator(std::unique_ptr<KVStore::Iterator> iter) : iter_(std::move(iter)) {}
+
+    void seek_to_first() override { iter_->seek_to_first(); }
+    void seek_to_last() override { iter_->seek_to_last(); }
+    void seek(const std::string& key) override { iter_->seek(key); }
+    bool valid() const override { return iter_->valid(); }
+    void next() override { iter_->next(); }
+    void prev() override { iter_->prev(); }
+
+    std::string_view key() const override { return iter_->key(); }
+    uint64_t sequence() const override { return 0; }
+    std::string_view value() const override { return iter_->value(); }
+    bool deleted() const override { return false; }
+    bool is_blob_index() const override { return false; }
+
+private:
+    std::unique_ptr<KVStore::Iterator> iter_;
+};
+
+// Runs fn on every shard at once and waits for all of them
+void for_each_shard(std::vector<std::unique_ptr<KVStore>>& shards,
+                    const std::function<void(KVStore&)>& fn) {
+    std::vector<std::thread> threads;
+    for (auto& shard : shards) {
+        threads.emplace_back([&fn, &shard] { fn(*shard); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+}
+
+ShardedKVStore::ShardedKVStore(const std::string& data_dir, size_t num_shards, const Options& options)
+    : data_dir_(data_dir) {
+    std::filesystem::create_directories(data_dir_);
+    num_shards = load_shard_count(data_dir_, std::max<size_t>(num_shards, 1));
+
+    // One cache budget and one set of counters for the whole store rather
+    // than one per shard
+    Options shard_options = options;
+    if (!shard_options.block_cache && shard_options.block_cache_size > 0) {
+        shard_options.block_cache = std::make_shared<BlockCache>(shard_options.block_cache_size);
+    }
+    if (!shard_options.statistics) {
+        shard_options.statistics = std::make_shared<Statistics>();
+    }
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<KVStore>(data_dir_ + "/shard_" + std::to_string(i),
+                                                    shard_options));
+    }
+}
+
+ShardedKVStore::~ShardedKVStore() {
+    close();
+}
+
+size_t ShardedKVStore::load_shard_count(const std::string& data_dir, size_t requested) {
+    // The count is fixed when the store is created and kept in SHARDS
+    std::string path = data_dir + "/SHARDS";
+    {
+        std::ifstream in(path);
+        size_t stored = 0;
+        if (in >> stored && stored > 0) {
+            return stored;
+        }
+    }
+
+    // Without it, existing shards still decide the count: keys only route
+    // to where they were written with the count they were written with
+    size_t count = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(data_dir)) {
+        std::string name = entry.path().filename().string();
+        std::string digits = name.size() > 6 && name.compare(0, 6, "shard_") == 0 ? name.substr(6) : "";
+        if (entry.is_directory() && !digits.empty() &&
+            std::all_of(digits.begin(), digits.end(), ::isdigit)) {
+            count = std::max<size_t>(count, std::stoull(digits) + 1);
+        }
+    }
+    if (count > 0) {
+        std::cerr << "MiniKV: " << path << " is missing or unreadable; using the " << count
+                  << " shards found\n";
+    } else {
+        count = requested;
+    }
+
+    // Written before any shard exists, and replaced whole
+    std::string temp = path + ".tmp";
+    std::ofstream out(temp, std::ios::trunc);
+    out << count << "\n";
+    out.close();
+    std::error_code ec;
+    bool ok = out.good() && utils::sync_file(temp);
+    if (ok) {
+        std::filesystem::rename(temp, path, ec);
+        ok = !ec && utils::sync_dir(data_dir);
+    }
+    if (!ok) {
+        std::cerr << "MiniKV: failed to write " << path << "\n";
+        std::filesystem::remove(temp, ec);
+    }
+    return count;
+}
+
+size_t ShardedKVStore::shard_index(const std::string& key) const {
+    return utils::hash(key.data(), key.size(), kShardSeed) % shards_.size();
+}
+
+bool ShardedKVStore::put(const std::string& key, const std::string& value) {
+    return shards_[shard_index(key)]->put(key, value);
+}
+
+bool ShardedKVStore::get(const std::string& key, std::string& value) {
+    return shards_[shard_index(key)]->get(key, value);
+}
+
+std::vector<std::optional<std::string>> ShardedKVStore::multi_get(const std::vector<std::string>& keys) {
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    std::vector<std::vector<size_t>> positions(shards_.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        size_t shard = shard_index(keys[i]);
+        shard_keys[shard].push_back(keys[i]);
+        positions[shard].push_back(i);
+    }
+
+    std::vector<std::optional<std::string>> values(keys.size());
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+        if (shard_keys[shard].empty()) continue;
+        auto found = shards_[shard]->multi_get(shard_keys[shard]);
+        for (size_t j = 0; j < found.size(); ++j) {
+            values[positions[shard][j]] = std::move(found[j]);
+        }
+    }
+    return values;
+}
+
+bool ShardedKVStore::remove(const std::string& key) {
+    return shards_[shard_index(key)]->remove(key);
+}
+
+bool ShardedKVStore::write(const WriteBatch& batch) {
+    // One sub-batch per shard, keeping the order of operations within each
+    std::vector<WriteBatch> parts(shards_.size());
+    for (const auto& entry : batch.entries()) {
+        WriteBatch& part = parts[shard_index(entry.key)];
+        if (entry.op_type == WAL::OpType::DELETE) {
+            part.remove(entry.key);
+        } else {
+            part.put(entry.key, entry.value);
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        if (!parts[i].empty()) {
+            ok = shards_[i]->write(parts[i]) && ok;
+        }
+    }
+    return ok;
+}
+
+std::unique_ptr<ShardedKVStore::Iterator> ShardedKVStore::new_iterator(const ReadOptions& options) {
+    ReadOptions shard_options = options;
+    shard_options.snapshot.reset();
+
+    std::vector<std::unique_ptr<InternalIterator>> children;
+    for (auto& shard : shards_) {
+        children.push_back(std::make_unique<ShardIterator>(shard->new_iterator(shard_options)));
+    }
+    auto merged = std::make_unique<MergingIterator>(std::move(children));
+    return std::unique_ptr<Iterator>(new Iterator(std::move(merged)));
+}
+
+void ShardedKVStore::flush_memtable() {
+    for_each_shard(shards_, [](KVStore& shard) { shard.flush_memtable(); });
+}
+
+void ShardedKVStore::compact() {
+    for_each_shard(shards_, [](KVStore& shard) { shard.compact(); });
+}
+
+void ShardedKVStore::close() {
+    for (auto& shard : shards_) {
+        shard->close();
+    }
+}
+
+StatsSnapshot ShardedKVStore::get_stats() const {
+    // The shards share their Statistics and cache, so any one sees the totals
+    return shards_[0]->get_stats();
+}
+
+size_t ShardedKVStore::num_shards() const {
+    return shards_.size();
+}
+
+ShardedKVStore::Iterator::Iterator(std::unique_ptr<MergingIterator> merged)
+    : merged_(std::move(merged)) {
+}
+
+ShardedKVStore::Iterator::~Iterator() = default;
+
+void ShardedKVStore::Iterator::seek_to_first() {
+    merged_->seek_to_first();
+}
+
+void ShardedKVStore::Iterator::seek_to_last() {
+    merged_->seek_to_last();
+}
+
+void ShardedKVStore::Iterator::seek(const std::string& key) {
+    merged_->seek(key);
+}
+
+bool ShardedKVStore::Iterator::valid() const {
+    return merged_->valid();
+}
+
+void ShardedKVStore::Iterator::next() {
+    merged_->next();
+}
+
+void ShardedKVStore::Iterator::prev() {
+    merged_->prev();
+}
+
+std::string_view ShardedKVStore::Iterator::key() const {
+    return merged_->key();
+}
+
+std::string_view ShardedKVStore::Iterator::value() const {
+    return merged_->value();
+}
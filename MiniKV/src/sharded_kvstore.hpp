@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <optional>
+#include "kvstore.hpp"
+#include "options.hpp"
+
+class MergingIterator;
+class WriteBatch;
+
+// Front end that spreads keys over independent KVStore shards by hash, so
+// writers to different shards never share a WAL, memtable or lock. Shard i
+// lives in data_dir/shard_<i>, and all shards share one block cache.
+//
+// Single-key operations behave as on a KVStore. A WriteBatch is split by
+// shard and is only atomic within each one, and scans merge the shards'
+// iterators without a common snapshot.
+class ShardedKVStore {
+public:
+    // num_shards only applies to a new store; an existing one keeps the
+    // count it was created with, since it decides where keys live
+    ShardedKVStore(const std::string& data_dir = "./data", size_t num_shards = 4,
+                   const Options& options = Options());
+    ~ShardedKVStore();
+
+    bool put(const std::string& key, const std::string& value);
+    bool get(const std::string& key, std::string& value);
+    // KVStore::multi_get, with each shard given its own keys in one batch
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys);
+    bool remove(const std::string& key);
+    bool write(const WriteBatch& batch);
+
+    // Ordered scan over all shards. Each shard is read as of the moment the
+    // iterator was created; options.snapshot is ignored, as snapshots
+    // belong to a single shard.
+    class Iterator {
+    public:
+        ~Iterator();
+
+        void seek_to_first();
+        void seek_to_last();
+        void seek(const std::string& key);
+        bool valid() const;
+        void next();
+        void prev();
+
+        std::string_view key() const;
+        std::string_view value() const;
+
+    private:
+        friend class ShardedKVStore;
+        explicit Iterator(std::unique_ptr<MergingIterator> merged);
+
+        std::unique_ptr<MergingIterator> merged_;
+    };
+
+    std::unique_ptr<Iterator> new_iterator(const ReadOptions& options = ReadOptions());
+
+    void flush_memtable();
+    void compact();
+    void close();
+
+    size_t num_shards() const;
+    // Totals over all shards
+    StatsSnapshot get_stats() const;
+
+private:
+    std::string data_dir_;
+    std::vector<std::unique_ptr<KVStore>> shards_;
+
+    size_t shard_index(const std::string& key) const;
+    static size_t load_shard_count(const std::string& data_dir, size_t requested);
+};
@@ -1,138 +1,902 @@
 #include "sstable.hpp"
+#include "bloom.hpp"
+#include "compression.hpp"
+#include "blob.hpp"
+#include "utils.hpp"
 #include <iostream>
 #include <algorithm>
 #include<vector>
 #include <fstream>
+#include <cstdint>
+#include <cstring>
 
-SSTable::SSTable(const std::string& filename) : filename_(filename), valid_(false) {
-    std::ifstream file(filename_, std::ios::binary);
-    if (file.is_open()) {
-        build_index();
-        valid_ = true;
+namespace {
+
+// Tables end with a fixed-size footer; its last 9 bytes (version, magic) are
+// the same in every version so readers can pick the right layout:
+//   v1: [entries][filter]
+//       [filter_offset u64][filter_size u64][version u8][magic u64]
+//   v2: [data blocks][filter][index block]
+//       [index_offset u64][index_size u64][filter_offset u64][filter_size u64][version u8][magic u64]
+//   v3: v2 layout, with a type byte in front of every data block entry
+//   v4: [data blocks][filter][index block][meta block]
+//       [meta_offset u64][meta_size u64] followed by the v2 footer fields
+//   v5: v4 layout; entries carry a sequence number and the meta block the
+//       largest one
+//   v6: v5 layout with prefix compressed keys and restart points in data blocks
+//   v7: v6 layout; every data block is followed by the id of the codec it
+//       was compressed with
+//   v8: v7 layout with varint entry tags and lengths, in data blocks and
+//       in the index and meta blocks
+//   v9: v8 layout; entries may hold blob indexes, and the meta block ends
+//       with the bytes referenced in each blob file
+// Tables written before footers existed are plain entries up to EOF.
+constexpr uint64_t kTableMagic = 0x5353564b696e694dULL;  // "MiniKVSS"
+constexpr uint8_t kFormatVersion = 9;
+constexpr size_t kTrailerSize = sizeof(uint8_t) + sizeof(uint64_t);
+constexpr size_t kFooterSizeV1 = 2 * sizeof(uint64_t) + kTrailerSize;
+constexpr size_t kFooterSizeV2 = 4 * sizeof(uint64_t) + kTrailerSize;
+constexpr size_t kFooterSizeV4 = 6 * sizeof(uint64_t) + kTrailerSize;
+
+// Entry types stored from v3 on
+constexpr uint8_t kTypeDeletion = 0;
+constexpr uint8_t kTypeValue = 1;
+constexpr uint8_t kTypeBlobIndex = 2;  // from v9 on
+
+template <typename T>
+void put_fixed(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T>
+bool get_fixed(const char*& p, const char* limit, T& v) {
+    if (static_cast<size_t>(limit - p) < sizeof(v)) return false;
+    std::memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+// Lengths are u16 up to v7 and varints from v8 on
+bool get_length(const char*& p, const char* limit, uint8_t version, size_t& length) {
+    if (version >= 8) {
+        uint64_t v;
+        if (!utils::get_varint(p, limit, v) || v > static_cast<size_t>(limit - p)) return false;
+        length = static_cast<size_t>(v);
+        return true;
+    }
+    uint16_t v;
+    if (!get_fixed(p, limit, v)) return false;
+    length = v;
+    return true;
+}
+
+void put_string(std::string& out, std::string_view s) {
+    utils::put_varint(out, s.length());
+    out.append(s.data(), s.length());
+}
+
+bool get_string(const char*& p, const char* limit, uint8_t version, std::string& s) {
+    size_t len;
+    if (!get_length(p, limit, version, len) || static_cast<size_t>(limit - p) < len) return false;
+    s.assign(p, len);
+    p += len;
+    return true;
+}
+
+// Data block entry up to v5: [tag u64 = sequence << 8 | type][key_len u16][key][val_len u16][value]
+//
+// v6 entries drop the part of the key shared with the previous entry:
+//   [tag u64][shared u16][unshared u16][val_len u16][key suffix][value]
+// and the block ends with [restart offset u32]...[num_restarts u32], the
+// offsets of the entries with shared == 0.
+//
+// v8 writes the tag and the three lengths as varints:
+//   [tag varint][shared varint][unshared varint][val_len varint][key suffix][value]
+void append_entry(std::string& block, uint8_t type, uint64_t sequence, size_t shared,
+                  std::string_view key, std::string_view value) {
+    utils::put_varint(block, sequence << 8 | type);
+    utils::put_varint(block, shared);
+    utils::put_varint(block, key.size() - shared);
+    utils::put_varint(block, value.size());
+    block.append(key.data() + shared, key.size() - shared);
+    block.append(value.data(), value.size());
+}
+
+size_t shared_prefix(std::string_view a, std::string_view b) {
+    size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        ++i;
     }
+    return i;
+}
+
 }
 
+bool SSTable::decode_entry(const char*& p, const char* limit, uint8_t version, EntryView& entry) {
+    uint16_t key_len, val_len;
+    entry.type = kTypeValue;
+    entry.sequence = 0;
+    if (version >= 5) {
+        uint64_t tag;
+        if (!get_fixed(p, limit, tag)) return false;
+        entry.type = static_cast<uint8_t>(tag & 0xff);
+        entry.sequence = tag >> 8;
+    } else if (version >= 3 && !get_fixed(p, limit, entry.type)) {
+        return false;
+    }
+    if (!get_fixed(p, limit, key_len) || static_cast<size_t>(limit - p) < key_len) {
+        return false;
+    }
+    entry.key = std::string_view(p, key_len);
+    p += key_len;
+    if (!get_fixed(p, limit, val_len) || static_cast<size_t>(limit - p) < val_len) {
+        return false;
+    }
+    entry.value = std::string_view(p, val_len);
+    p += val_len;
+    return true;
+}
+
+bool SSTable::decode_delta_entry(const char*& p, const char* limit, uint8_t version,
+                                 std::string& key, EntryView& entry) {
+    uint64_t tag;
+    size_t shared, unshared, val_len;
+    if (version >= 8) {
+        uint64_t s, u, v;
+        if (!utils::get_varint(p, limit, tag) || !utils::get_varint(p, limit, s) ||
+            !utils::get_varint(p, limit, u) || !utils::get_varint(p, limit, v) ||
+            u > static_cast<size_t>(limit - p) || v > static_cast<size_t>(limit - p)) {
+            return false;
+        }
+        shared = static_cast<size_t>(s);
+        unshared = static_cast<size_t>(u);
+        val_len = static_cast<size_t>(v);
+    } else {
+        uint16_t s, u, v;
+        if (!get_fixed(p, limit, tag) || !get_fixed(p, limit, s) ||
+            !get_fixed(p, limit, u) || !get_fixed(p, limit, v)) {
+            return false;
+        }
+        shared = s;
+        unshared = u;
+        val_len = v;
+    }
+    if (shared > key.size() || static_cast<size_t>(limit - p) < unshared + val_len) {
+        return false;
+    }
+    entry.type = static_cast<uint8_t>(tag & 0xff);
+    entry.sequence = tag >> 8;
+    key.resize(shared);
+    key.append(p, unshared);
+    entry.key = key;
+    p += unshared;
+    entry.value = std::string_view(p, val_len);
+    p += val_len;
+    return true;
+}
+
+SSTable::SSTable(const std::string& filename, const Options& options)
+    : filename_(filename), options_(options), valid_(false), version_(0),
+      level_(0), file_size_(0), largest_sequence_(0), cache_id_(0) {
+    if (options_.block_cache) {
+        cache_id_ = options_.block_cache->new_file_id();
+    }
+
+    if (open_file()) {
+        valid_ = load();
+    }
+}
+
+SSTable::~SSTable() = default;
+
+bool SSTable::open_file() {
+    if (options_.use_mmap_reads && mapping_.open(filename_)) {
+        // Point lookups touch one block each; don't let readahead pull in more
+        mapping_.advise(utils::MappedFile::Access::RANDOM);
+        return true;
+    }
+    // Keep a descriptor instead, so scans survive a compaction unlinking us
+    return file_.open(filename_);
+}
+
+// State of an in-progress write, between begin_write() and finish_write()
+struct SSTable::WriteState {
+    std::ofstream file;
+    uint64_t offset = 0;
+    std::string block;
+    std::string last_key;
+    std::vector<uint32_t> restarts;  // of the current block
+    int since_restart = 0;
+    std::string compressed;          // scratch for finish_block
+    std::vector<std::string> keys;
+};
+
 bool SSTable::write(const std::map<std::string, std::string>& data) {
-    std::ofstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
+    if (!begin_write()) {
         return false;
     }
+    for (const auto& [key, value] : data) {
+        add(key, value);
+    }
+    return finish_write();
+}
+
+bool SSTable::write(const MemTable& memtable) {
+    if (!begin_write()) {
+        return false;
+    }
+    MemTable::Iterator it(&memtable);
+    for (it.seek_to_first(); it.valid(); it.next()) {
+        add(it.key(), it.value(), it.deleted(), it.sequence());
+    }
+    return finish_write();
+}
+
+bool SSTable::begin_write(int level) {
+    mapping_.close();
+    if (options_.block_cache) {
+        cache_id_ = options_.block_cache->new_file_id();  // drop anything cached for old contents
+    }
 
+    writer_ = std::make_unique<WriteState>();
+    writer_->file.open(filename_, std::ios::binary | std::ios::trunc);
+    if (!writer_->file.is_open()) {
+        writer_.reset();
+        return false;
+    }
+
+    valid_ = false;
+    level_ = level;
+    file_size_ = 0;
     index_.clear();
-    size_t offset = 0;
+    filter_.clear();
+    smallest_key_.clear();
+    largest_key_.clear();
+    largest_sequence_ = 0;
+    blob_references_.clear();
+    return true;
+}
 
-    // Write data and build index
-    for (const auto& [key, value] : data) {
-        size_t entry_start = offset;
+void SSTable::add(std::string_view key, std::string_view value, bool deleted, uint64_t sequence) {
+    add_entry(key, value, deleted ? kTypeDeletion : kTypeValue, sequence);
+}
 
-        // Write key length and key
-        uint16_t key_len = static_cast<uint16_t>(key.length());
-        file.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
-        file.write(key.c_str(), key_len);
+void SSTable::add_blob_index(std::string_view key, std::string_view index, uint64_t sequence) {
+    BlobIndex blob;
+    if (blob.decode_from(index)) {
+        blob_references_[blob.file_number] += blob.size;
+    }
+    add_entry(key, index, kTypeBlobIndex, sequence);
+}
 
-        // Write value length and value
-        uint16_t val_len = static_cast<uint16_t>(value.length());
-        file.write(reinterpret_cast<const char*>(&val_len), sizeof(val_len));
-        file.write(value.c_str(), val_len);
+void SSTable::add_entry(std::string_view key, std::string_view value, uint8_t type, uint64_t sequence) {
+    if (index_.empty() && writer_->block.empty()) {
+        smallest_key_ = key;
+    }
+    auto& w = *writer_;
+    size_t shared = 0;
+    if (w.block.empty() || w.since_restart >= options_.block_restart_interval) {
+        w.restarts.push_back(static_cast<uint32_t>(w.block.size()));
+        w.since_restart = 0;
+    } else {
+        shared = shared_prefix(w.last_key, key);
+    }
+    ++w.since_restart;
+    append_entry(w.block, type, sequence, shared, key, value);
+    largest_sequence_ = std::max(largest_sequence_, sequence);
+    writer_->last_key = key;
+    // Older versions of a key share its filter entry
+    if (options_.bloom_bits_per_key > 0 && (writer_->keys.empty() || writer_->keys.back() != key)) {
+        writer_->keys.emplace_back(key);
+    }
 
-        size_t entry_size = sizeof(key_len) + key_len + sizeof(val_len) + val_len;
-        index_.push_back({key, entry_start, entry_size});
-        offset += entry_size;
+    // Cut a new data block once the current one is full
+    if (writer_->block.size() >= options_.block_size) {
+        finish_block();
     }
+}
+
+void SSTable::finish_block() {
+    auto& w = *writer_;
+    if (w.block.empty()) return;
+    for (uint32_t restart : w.restarts) {
+        put_fixed(w.block, restart);
+    }
+    put_fixed(w.block, static_cast<uint32_t>(w.restarts.size()));
+    w.restarts.clear();
+
+    // Keep the compressed form only if it saves at least an eighth
+    const std::string* out = &w.block;
+    uint8_t codec_id = kNoCompression;
+    const Compressor* codec = options_.compression != kNoCompression
+        ? find_compressor(options_.compression) : nullptr;
+    if (codec) {
+        w.compressed.clear();
+        codec->compress(w.block, w.compressed);
+        if (w.compressed.size() < w.block.size() - w.block.size() / 8) {
+            out = &w.compressed;
+            codec_id = codec->id();
+        }
+    }
+    w.file.write(out->data(), out->size());
+    w.file.put(static_cast<char>(codec_id));
+    index_.push_back({w.last_key, w.offset, out->size() + 1});
+    w.offset += out->size() + 1;
+    w.block.clear();
+}
+
+bool SSTable::finish_write() {
+    finish_block();
+    auto& w = *writer_;
+    largest_key_ = w.last_key;
 
-    valid_ = file.good();
+    // Write filter
+    if (options_.bloom_bits_per_key > 0) {
+        filter_ = BloomFilter::build(w.keys, options_.bloom_bits_per_key);
+    }
+    uint64_t filter_offset = w.offset;
+    w.file.write(filter_.data(), filter_.size());
+    w.offset += filter_.size();
+
+    // Write index block: last key of each data block and where to find it
+    std::string index_block;
+    for (const auto& entry : index_) {
+        put_string(index_block, entry.key);
+        put_fixed(index_block, static_cast<uint64_t>(entry.offset));
+        put_fixed(index_block, static_cast<uint32_t>(entry.size));
+    }
+    uint64_t index_offset = w.offset;
+    w.file.write(index_block.data(), index_block.size());
+    w.offset += index_block.size();
+
+    // Write meta block: level, key range and newest sequence, used to place
+    // the table and restore the store's sequence counter on open
+    std::string meta_block;
+    put_fixed(meta_block, static_cast<uint8_t>(level_));
+    put_string(meta_block, smallest_key_);
+    put_string(meta_block, largest_key_);
+    put_fixed(meta_block, largest_sequence_);
+    utils::put_varint(meta_block, blob_references_.size());
+    for (const auto& [file_number, bytes] : blob_references_) {
+        utils::put_varint(meta_block, file_number);
+        utils::put_varint(meta_block, bytes);
+    }
+    uint64_t meta_offset = w.offset;
+    w.file.write(meta_block.data(), meta_block.size());
+    w.offset += meta_block.size();
+
+    // Write footer
+    std::string footer;
+    put_fixed(footer, meta_offset);
+    put_fixed(footer, static_cast<uint64_t>(meta_block.size()));
+    put_fixed(footer, index_offset);
+    put_fixed(footer, static_cast<uint64_t>(index_block.size()));
+    put_fixed(footer, filter_offset);
+    put_fixed(footer, static_cast<uint64_t>(filter_.size()));
+    put_fixed(footer, kFormatVersion);
+    put_fixed(footer, kTableMagic);
+    w.file.write(footer.data(), footer.size());
+    w.offset += footer.size();
+    w.file.close();
+
+    valid_ = w.file.good() && utils::sync_file(filename_);
+    version_ = kFormatVersion;
+    file_size_ = w.offset;
+    writer_.reset();
+    if (valid_) {
+        valid_ = open_file();
+    }
     return valid_;
 }
 
 bool SSTable::get(const std::string& key, std::string& value) {
-    if (!valid_) return false;
+    return lookup(key, value) == LookupResult::FOUND;
+}
+
+LookupResult SSTable::lookup(const std::string& key, std::string& value, uint64_t snapshot) {
+    if (!valid_) return LookupResult::NOT_FOUND;
+
+    Iterator it(this);
+    return lookup(it, key, value, snapshot);
+}
+
+void SSTable::multi_lookup(const std::vector<const std::string*>& keys, uint64_t snapshot,
+                           std::vector<LookupResult>& results, std::vector<std::string>& values) {
+    results.assign(keys.size(), LookupResult::NOT_FOUND);
+    values.resize(keys.size());
+    if (!valid_) return;
+
+    // One iterator for the whole batch: a seek that stays in its current
+    // block doesn't read it again
+    Iterator it(this);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        results[i] = lookup(it, *keys[i], values[i], snapshot);
+    }
+}
+
+LookupResult SSTable::lookup(Iterator& it, const std::string& key, std::string& value, uint64_t snapshot) {
+    // Negative lookups usually stop at the filter without touching the index
+    if (!may_contain(key)) {
+        return LookupResult::NOT_FOUND;
+    }
+
+    // Versions of key sit together, newest first, starting in the first
+    // block whose last key is >= key; skip those the snapshot can't see
+    for (it.seek(key); it.valid() && it.key() == key; it.next()) {
+        if (it.sequence() > snapshot) {
+            continue;
+        }
+        if (it.deleted()) {
+            return LookupResult::DELETED;
+        }
+        value.assign(it.value());
+        return it.is_blob_index() ? LookupResult::BLOB_INDEX : LookupResult::FOUND;
+    }
+    return LookupResult::NOT_FOUND;
+}
+
+size_t SSTable::find_block(const std::string& key) const {
+    auto it = std::lower_bound(index_.begin(), index_.end(), key,
+        [](const IndexEntry& entry, const std::string& k) {
+            return entry.key < k;
+        });
+    return static_cast<size_t>(it - index_.begin());
+}
 
-    size_t offset, size;
-    if (!binary_search_key(key, offset, size)) {
+bool SSTable::read_block(size_t block, BlockContents& contents, bool fill_cache) {
+    const IndexEntry& entry = index_[block];
+    const size_t trailer = version_ >= 7 ? 1 : 0;
+    if (entry.size < trailer) {
         return false;
     }
 
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
+    // Uncompressed blocks of mapped tables are decoded in place; everything
+    // else goes through the block cache, which holds blocks uncompressed
+    if (mapping_.is_open()) {
+        if (entry.offset + entry.size > mapping_.size()) {
+            return false;
+        }
+        const char* data = mapping_.data() + entry.offset;
+        if (trailer == 0 || static_cast<uint8_t>(data[entry.size - 1]) == kNoCompression) {
+            contents.data = data;
+            contents.size = entry.size - trailer;
+            contents.holder.reset();
+            return true;
+        }
+    }
+
+    BlockCache* cache = options_.block_cache.get();
+    BlockCache::Block buffer = cache ? cache->lookup(cache_id_, entry.offset) : nullptr;
+    if (!buffer) {
+        auto fresh = std::make_shared<std::string>();
+        if (!read_at(entry.offset, entry.size, *fresh) || !uncompress_block(*fresh, trailer)) {
+            return false;
+        }
+        buffer = fresh;
+        if (cache && fill_cache) {
+            cache->insert(cache_id_, entry.offset, buffer);
+        }
+    }
+    contents.data = buffer->data();
+    contents.size = buffer->size();
+    contents.holder = std::move(buffer);
+    return true;
+}
+
+bool SSTable::uncompress_block(std::string& block, size_t trailer) {
+    if (trailer == 0) {
+        return true;
+    }
+    uint8_t codec_id = static_cast<uint8_t>(block.back());
+    block.pop_back();
+    if (codec_id == kNoCompression) {
+        return true;
+    }
+    const Compressor* codec = find_compressor(codec_id);
+    std::string raw;
+    if (!codec || !codec->decompress(block, raw)) {
         return false;
     }
+    block.swap(raw);
+    return true;
+}
+
+bool SSTable::read_at(uint64_t offset, uint64_t size, std::string& out) {
+    if (mapping_.is_open()) {
+        if (offset + size > mapping_.size()) {
+            return false;
+        }
+        out.assign(mapping_.data() + offset, size);
+        return true;
+    }
 
-    file.seekg(offset);
+    return file_.read(offset, size, out);
+}
 
-    // Read key length and key
-    uint16_t key_len;
-    file.read(reinterpret_cast<char*>(&key_len), sizeof(key_len));
+bool SSTable::load() {
+    uint64_t file_size = mapping_.is_open() ? mapping_.size() : utils::file_size(filename_);
+    file_size_ = file_size;
 
-    std::string read_key(key_len, '\\0');
-    file.read(&read_key[0], key_len);
+    uint8_t version = 0;
+    uint64_t magic = 0;
+    std::string trailer;
+    if (file_size >= kTrailerSize && read_at(file_size - kTrailerSize, kTrailerSize, trailer)) {
+        const char* p = trailer.data();
+        get_fixed(p, p + trailer.size(), version);
+        get_fixed(p, p + trailer.size(), magic);
+    }
+    if (magic != kTableMagic) {
+        return build_legacy_index(file_size) && load_key_range();
+    }
 
-    // Verify key matches
-    if (read_key != key) {
-        return false;
+    std::string footer;
+    version_ = version;
+    if (version == 1 && file_size >= kFooterSizeV1) {
+        // Flat entries followed by a filter
+        uint64_t filter_offset = 0, filter_size = 0;
+        if (!read_at(file_size - kFooterSizeV1, kFooterSizeV1 - kTrailerSize, footer)) {
+            return false;
+        }
+        const char* p = footer.data();
+        const char* limit = p + footer.size();
+        get_fixed(p, limit, filter_offset);
+        get_fixed(p, limit, filter_size);
+        if (filter_offset + filter_size + kFooterSizeV1 != file_size ||
+            !read_at(filter_offset, filter_size, filter_)) {
+            return false;
+        }
+        return build_legacy_index(filter_offset) && load_key_range();
     }
 
-    // Read value length and value
-    uint16_t val_len;
-    file.read(reinterpret_cast<char*>(&val_len), sizeof(val_len));
+    if (version >= 2 && version <= kFormatVersion) {
+        // Only the footer, filter, index and meta blocks are read at open
+        size_t footer_size = version >= 4 ? kFooterSizeV4 : kFooterSizeV2;
+        if (file_size < footer_size ||
+            !read_at(file_size - footer_size, footer_size - kTrailerSize, footer)) {
+            return false;
+        }
+        uint64_t meta_offset = 0, meta_size = 0;
+        uint64_t index_offset = 0, index_size = 0, filter_offset = 0, filter_size = 0;
+        const char* p = footer.data();
+        const char* limit = p + footer.size();
+        if (version >= 4) {
+            get_fixed(p, limit, meta_offset);
+            get_fixed(p, limit, meta_size);
+        }
+        get_fixed(p, limit, index_offset);
+        get_fixed(p, limit, index_size);
+        get_fixed(p, limit, filter_offset);
+        get_fixed(p, limit, filter_size);
+        uint64_t index_end = version >= 4 ? meta_offset : file_size - footer_size;
+        if (index_offset + index_size != index_end ||
+            meta_offset + meta_size + (version >= 4 ? footer_size : 0) > file_size ||
+            filter_offset + filter_size > index_offset) {
+            return false;
+        }
+
+        std::string index_block;
+        if (!read_at(filter_offset, filter_size, filter_) ||
+            !read_at(index_offset, index_size, index_block) ||
+            !parse_index_block(index_block)) {
+            return false;
+        }
+        if (version < 4) {
+            return load_key_range();
+        }
+
+        std::string meta_block;
+        uint8_t level;
+        if (!read_at(meta_offset, meta_size, meta_block)) {
+            return false;
+        }
+        p = meta_block.data();
+        limit = p + meta_block.size();
+        if (!get_fixed(p, limit, level) || !get_string(p, limit, version, smallest_key_) ||
+            !get_string(p, limit, version, largest_key_) ||
+            (version >= 5 && !get_fixed(p, limit, largest_sequence_))) {
+            return false;
+        }
+        level_ = level;
 
-    value.resize(val_len);
-    file.read(&value[0], val_len);
+        uint64_t count = 0;
+        if (version >= 9 && !utils::get_varint(p, limit, count)) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t file_number, bytes;
+            if (!utils::get_varint(p, limit, file_number) || !utils::get_varint(p, limit, bytes)) {
+                return false;
+            }
+            blob_references_[file_number] = bytes;
+        }
+        return true;
+    }
 
-    return file.good();
+    return false;
 }
 
-void SSTable::build_index() {
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) return;
+bool SSTable::load_key_range() {
+    // Tables without a meta block: first key of the first block, last key of the index
+    smallest_key_.clear();
+    largest_key_.clear();
+    if (index_.empty()) {
+        return true;
+    }
 
+    BlockContents contents;
+    if (!read_block(0, contents, false)) {
+        return false;
+    }
+    const char* p = contents.data;
+    EntryView entry;
+    if (!decode_entry(p, contents.data + contents.size, version_, entry)) {
+        return false;
+    }
+    smallest_key_.assign(entry.key.data(), entry.key.size());
+    largest_key_ = index_.back().key;
+    return true;
+}
+
+bool SSTable::parse_index_block(const std::string& index_block) {
     index_.clear();
-    size_t offset = 0;
+    const char* p = index_block.data();
+    const char* limit = p + index_block.size();
+
+    while (p < limit) {
+        std::string key;
+        uint64_t offset;
+        uint32_t size;
+        if (!get_string(p, limit, version_, key) || !get_fixed(p, limit, offset) || !get_fixed(p, limit, size)) {
+            return false;
+        }
+        index_.push_back({std::move(key), offset, size});
+    }
+
+    return true;
+}
 
-    while (file.good() && !file.eof()) {
-        size_t entry_start = offset;
+bool SSTable::build_legacy_index(size_t data_end) {
+    // Without an index block every entry is indexed as a one-entry block
+    index_.clear();
 
-        // Read key length
-        uint16_t key_len;
-        if (!file.read(reinterpret_cast<char*>(&key_len), sizeof(key_len))) {
+    std::string data;
+    if (mapping_.is_open()) {
+        mapping_.advise(utils::MappedFile::Access::SEQUENTIAL, 0, data_end);
+    }
+    if (!read_at(0, data_end, data)) {
+        return false;
+    }
+
+    const char* begin = data.data();
+    const char* p = begin;
+    const char* limit = begin + data.size();
+    EntryView entry;
+    while (p < limit) {
+        const char* entry_start = p;
+        if (!decode_entry(p, limit, 0, entry)) {
             break;
         }
+        index_.push_back({std::string(entry.key), static_cast<size_t>(entry_start - begin),
+                          static_cast<size_t>(p - entry_start)});
+    }
 
-        // Read key
-        std::string key(key_len, '\\0');
-        if (!file.read(&key[0], key_len)) {
-            break;
+    if (mapping_.is_open()) {
+        mapping_.advise(utils::MappedFile::Access::RANDOM, 0, data_end);
+    }
+    return true;
+}
+
+bool SSTable::may_contain(const std::string& key) const {
+    return filter_.empty() || BloomFilter::may_contain(filter_, key);
+}
+
+bool SSTable::is_valid() const {
+    return valid_;
+}
+
+const std::string& SSTable::filename() const {
+    return filename_;
+}
+
+int SSTable::level() const {
+    return level_;
+}
+
+uint64_t SSTable::file_size() const {
+    return writer_ ? writer_->offset + writer_->block.size() : file_size_;
+}
+
+const std::string& SSTable::smallest_key() const {
+    return smallest_key_;
+}
+
+const std::string& SSTable::largest_key() const {
+    return largest_key_;
+}
+
+uint64_t SSTable::largest_sequence() const {
+    return largest_sequence_;
+}
+
+const std::map<uint64_t, uint64_t>& SSTable::blob_references() const {
+    return blob_references_;
+}
+
+SSTable::Iterator::Iterator(SSTable* table, bool fill_cache)
+    : table_(table), fill_cache_(fill_cache), block_(0), entry_start_(nullptr),
+      next_entry_(nullptr), block_end_(nullptr), restarts_(nullptr), num_restarts_(0), valid_(false) {
+}
+
+void SSTable::Iterator::seek_to_first() {
+    load_block(0);
+    advance();
+}
+
+void SSTable::Iterator::seek_to_last() {
+    valid_ = false;
+    if (!table_->valid_ || table_->index_.empty()) {
+        return;
+    }
+    load_block(table_->index_.size() - 1);
+    seek_before(block_end_);
+}
+
+void SSTable::Iterator::seek(const std::string& key) {
+    // Start in the only block that can hold key, at the last restart point
+    // before it, then skip smaller entries. The block is only read again
+    // if it isn't the one already loaded.
+    size_t block = table_->find_block(key);
+    if (block != block_ || contents_.data == nullptr) {
+        load_block(block);
+    } else {
+        next_entry_ = contents_.data;
+        key_.clear();
+    }
+    if (num_restarts_ > 0) {
+        uint32_t left = 0, right = num_restarts_ - 1;
+        while (left < right) {
+            uint32_t mid = left + (right - left + 1) / 2;
+            seek_to_restart(mid);
+            decode_next();
+            if (valid_ && entry_.key < std::string_view(key)) {
+                left = mid;
+            } else {
+                right = mid - 1;
+            }
         }
+        seek_to_restart(left);
+    }
+    advance();
+    while (valid_ && entry_.key < std::string_view(key)) {
+        advance();
+    }
+}
 
-        // Read value length
-        uint16_t val_len;
-        if (!file.read(reinterpret_cast<char*>(&val_len), sizeof(val_len))) {
-            break;
+bool SSTable::Iterator::valid() const {
+    return valid_;
+}
+
+void SSTable::Iterator::next() {
+    advance();
+}
+
+void SSTable::Iterator::prev() {
+    const char* target = entry_start_;
+    if (target == contents_.data) {
+        // First entry of its block: continue from the end of the previous one
+        valid_ = false;
+        if (block_ == 0) {
+            return;
         }
+        load_block(block_ - 1);
+        target = block_end_;
+    }
+    seek_before(target);
+}
+
+std::string_view SSTable::Iterator::key() const {
+    return entry_.key;
+}
 
-        // Skip value
-        file.seekg(val_len, std::ios::cur);
+uint64_t SSTable::Iterator::sequence() const {
+    return entry_.sequence;
+}
+
+std::string_view SSTable::Iterator::value() const {
+    return entry_.value;
+}
+
+bool SSTable::Iterator::deleted() const {
+    return entry_.type == kTypeDeletion;
+}
+
+bool SSTable::Iterator::is_blob_index() const {
+    return entry_.type == kTypeBlobIndex;
+}
 
-        size_t entry_size = sizeof(key_len) + key_len + sizeof(val_len) + val_len;
-        index_.push_back({key, entry_start, entry_size});
-        offset += entry_size;
+void SSTable::Iterator::load_block(size_t block) {
+    block_ = block;
+    contents_ = BlockContents();
+    next_entry_ = block_end_ = restarts_ = nullptr;
+    num_restarts_ = 0;
+    if (!table_->valid_ || block_ >= table_->index_.size() ||
+        !table_->read_block(block_, contents_, fill_cache_)) {
+        return;
+    }
+    next_entry_ = contents_.data;
+    block_end_ = contents_.data + contents_.size;
+    key_.clear();
+
+    if (table_->version_ >= 6) {
+        // Restart array at the tail; a block that can't hold it reads as empty
+        const char* p = block_end_ - std::min(contents_.size, sizeof(uint32_t));
+        uint32_t count = 0;
+        if (!get_fixed(p, block_end_, count) ||
+            (contents_.size - sizeof(uint32_t)) / sizeof(uint32_t) < count) {
+            block_end_ = next_entry_;
+            return;
+        }
+        num_restarts_ = count;
+        restarts_ = block_end_ - sizeof(uint32_t) * (count + 1);
+        block_end_ = restarts_;
     }
 }
 
-bool SSTable::binary_search_key(const std::string& key, size_t& offset, size_t& size) {
-    auto it = std::lower_bound(index_.begin(), index_.end(), key,
-        [](const IndexEntry& entry, const std::string& k) {
-            return entry.key < k;
-        });
+uint32_t SSTable::Iterator::restart_offset(uint32_t restart) const {
+    uint32_t offset;
+    std::memcpy(&offset, restarts_ + restart * sizeof(uint32_t), sizeof(offset));
+    return std::min<uint32_t>(offset, static_cast<uint32_t>(block_end_ - contents_.data));
+}
 
-    if (it != index_.end() && it->key == key) {
-        offset = it->offset;
-        size = it->size;
-        return true;
+void SSTable::Iterator::seek_to_restart(uint32_t restart) {
+    // Entries at restart points hold their whole key
+    next_entry_ = contents_.data + restart_offset(restart);
+    key_.clear();
+}
+
+void SSTable::Iterator::advance() {
+    // Move on to the following block once this one is exhausted
+    while (next_entry_ == block_end_) {
+        if (!table_->valid_ || block_ + 1 >= table_->index_.size()) {
+            valid_ = false;
+            return;
+        }
+        load_block(block_ + 1);
+        if (next_entry_ == nullptr) {
+            valid_ = false;
+            return;
+        }
     }
+    decode_next();
+}
 
-    return false;
+void SSTable::Iterator::decode_next() {
+    entry_start_ = next_entry_;
+    if (table_->version_ >= 6) {
+        valid_ = decode_delta_entry(next_entry_, block_end_, table_->version_, key_, entry_);
+    } else {
+        valid_ = decode_entry(next_entry_, block_end_, table_->version_, entry_);
+    }
 }
 
-bool SSTable::is_valid() const {
-    return valid_;
+void SSTable::Iterator::seek_before(const char* target) {
+    // Walk from the last restart point before target up to the last entry
+    // starting before it
+    valid_ = false;
+    next_entry_ = contents_.data;
+    if (num_restarts_ > 0) {
+        uint32_t restart = 0;
+        while (restart + 1 < num_restarts_ &&
+               contents_.data + restart_offset(restart + 1) < target) {
+            ++restart;
+        }
+        seek_to_restart(restart);
+    }
+    while (next_entry_ != nullptr && next_entry_ < target) {
+        decode_next();
+        if (!valid_) {
+            return;
+        }
+    }
 }
@@ -1,23 +1,132 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <fstream>
 #include<vector>
+#include "options.hpp"
+#include "utils.hpp"
+#include "cache.hpp"
+#include "memtable.hpp"
+#include <memory>
 using namespace std;
 class SSTable {
+    // A data block: a view into the mapping, or a buffer kept alive by holder
+    struct BlockContents {
+        const char* data = nullptr;
+        size_t size = 0;
+        BlockCache::Block holder;
+    };
+
+    // One decoded entry; value points into its block, and so does key unless
+    // the block is prefix compressed
+    struct EntryView {
+        uint8_t type = 0;
+        uint64_t sequence = 0;  // 0 for tables written before v5
+        std::string_view key;
+        std::string_view value;
+    };
+
 public:
-    explicit SSTable(const std::string& filename);
-    ~SSTable() = default;
+    explicit SSTable(const std::string& filename, const Options& options = Options());
+    ~SSTable();
 
     bool write(const std::map<std::string, std::string>& data);
+    bool write(const MemTable& memtable);
+
+    // Incremental writing: add() must be called in ascending key order, and
+    // versions of one key newest first
+    bool begin_write(int level = 0);
+    void add(std::string_view key, std::string_view value, bool deleted = false,
+             uint64_t sequence = 0);
+    // Adds an encoded BlobIndex standing in for the value
+    void add_blob_index(std::string_view key, std::string_view index, uint64_t sequence);
+    bool finish_write();
+
     bool get(const std::string& key, std::string& value);
+    // Finds the newest version of key no newer than snapshot
+    LookupResult lookup(const std::string& key, std::string& value,
+                        uint64_t snapshot = kMaxSequence);
+    // lookup for each of keys, which must be in ascending order, in one pass:
+    // keys that fall in the same block share its read. Fills results and
+    // values at the keys' positions.
+    void multi_lookup(const std::vector<const std::string*>& keys, uint64_t snapshot,
+                      std::vector<LookupResult>& results, std::vector<std::string>& values);
+    bool may_contain(const std::string& key) const;
     bool is_valid() const;
 
+    // Metadata used to place the table in the LSM tree
+    const std::string& filename() const;
+    int level() const;
+    uint64_t file_size() const;
+    const std::string& smallest_key() const;
+    const std::string& largest_key() const;
+    // Highest sequence number stored in the table
+    uint64_t largest_sequence() const;
+    // Record bytes the table's blob indexes point at, by blob file number
+    const std::map<uint64_t, uint64_t>& blob_references() const;
+
+    // Iteration over entries, including tombstones. The table must outlive
+    // the iterator; key() and value() stay valid until the next move.
+    class Iterator {
+    public:
+        explicit Iterator(SSTable* table, bool fill_cache = true);
+
+        void seek_to_first();
+        void seek_to_last();
+        void seek(const std::string& key);
+        bool valid() const;
+        void next();
+        // Entries only chain forward, so this rescans the current block
+        void prev();
+
+        std::string_view key() const;
+        uint64_t sequence() const;
+        std::string_view value() const;
+        bool deleted() const;
+        // value() is an encoded BlobIndex
+        bool is_blob_index() const;
+
+    private:
+        SSTable* table_;
+        bool fill_cache_;
+        size_t block_;
+        BlockContents contents_;
+        const char* entry_start_;  // where entry_ was decoded from
+        const char* next_entry_;
+        const char* block_end_;    // end of the entries, where restarts begin
+        const char* restarts_;     // u32 offsets of entries stored with whole keys
+        uint32_t num_restarts_;    // 0 for blocks without restart points
+        std::string key_;          // entry_.key of prefix compressed blocks
+        EntryView entry_;
+        bool valid_;
+
+        void load_block(size_t block);
+        void advance();
+        void decode_next();
+        void seek_before(const char* target);
+        uint32_t restart_offset(uint32_t restart) const;
+        void seek_to_restart(uint32_t restart);
+    };
+
 private:
     std::string filename_;
+    Options options_;
     bool valid_;
+    uint8_t version_;  // on-disk format version, 0 for tables without a footer
+    int level_;
+    uint64_t file_size_;
+    std::string smallest_key_;
+    std::string largest_key_;
+    uint64_t largest_sequence_;
+    std::map<uint64_t, uint64_t> blob_references_;
+    std::string filter_;
+    utils::MappedFile mapping_;  // mapped once at open when use_mmap_reads is set
+    utils::RandomAccessFile file_;  // used instead when the file isn't mapped
+    uint64_t cache_id_;          // identifies our blocks in options_.block_cache
 
+    // One entry per data block, keyed by the last key stored in it
     struct IndexEntry {
         std::string key;
         size_t offset;
@@ -26,6 +135,23 @@ private:
 
     std::vector<IndexEntry> index_;
 
-    void build_index();
-    bool binary_search_key(const std::string& key, size_t& offset, size_t& size);
+    struct WriteState;
+    std::unique_ptr<WriteState> writer_;
+
+    bool open_file();
+    bool load();
+    bool load_key_range();
+    bool parse_index_block(const std::string& index_block);
+    bool build_legacy_index(size_t data_end);
+    bool read_at(uint64_t offset, uint64_t size, std::string& out);
+    // Strips the codec trailer of a raw block and decompresses it in place
+    static bool uncompress_block(std::string& block, size_t trailer);
+    size_t find_block(const std::string& key) const;
+    LookupResult lookup(Iterator& it, const std::string& key, std::string& value, uint64_t snapshot);
+    bool read_block(size_t block, BlockContents& contents, bool fill_cache = true);
+    void add_entry(std::string_view key, std::string_view value, uint8_t type, uint64_t sequence);
+    void finish_block();
+    static bool decode_entry(const char*& p, const char* limit, uint8_t version, EntryView& entry);
+    static bool decode_delta_entry(const char*& p, const char* limit, uint8_t version,
+                                   std::string& key, EntryView& entry);
 };
@@ -0,0 +1,237 @@
+#include "statistics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+namespace {
+
+const char* const kTickerNames[] = {
+    "memtable.hit",
+    "memtable.miss",
+    "sstable.probes",
+    "get.hit",
+    "get.miss",
+    "bytes.written",
+    "bytes.read",
+    "wal.bytes",
+    "wal.syncs",
+    "flush.count",
+    "flush.bytes",
+    "compaction.count",
+    "compaction.bytes.read",
+    "compaction.bytes.written",
+    "stall.count",
+    "stall.micros",
+    "blob.bytes.written",
+    "blob.bytes.read",
+    "blob.gc.count",
+    "blob.gc.bytes",
+};
+
+const char* const kHistogramNames[] = {
+    "put",
+    "get",
+    "remove",
+    "write",
+    "flush",
+    "multi_get",
+};
+
+static_assert(sizeof(kTickerNames) / sizeof(kTickerNames[0]) == kNumTickers, "ticker names");
+static_assert(sizeof(kHistogramNames) / sizeof(kHistogramNames[0]) == kNumHistograms, "histogram names");
+
+uint64_t now_nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void update_min(std::atomic<uint64_t>& slot, uint64_t value) {
+    uint64_t current = slot.load(std::memory_order_relaxed);
+    while (value < current && !slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void update_max(std::atomic<uint64_t>& slot, uint64_t value) {
+    uint64_t current = slot.load(std::memory_order_relaxed);
+    while (value > current && !slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+}
+
+const char* ticker_name(Ticker ticker) {
+    return kTickerNames[static_cast<size_t>(ticker)];
+}
+
+const char* histogram_name(Histogram histogram) {
+    return kHistogramNames[static_cast<size_t>(histogram)];
+}
+
+std::string StatsSnapshot::to_string() const {
+    std::string out;
+    char line[256];
+    for (size_t i = 0; i < kNumTickers; ++i) {
+        if (tickers[i] == 0) continue;
+        std::snprintf(line, sizeof(line), "%-26s %llu\n", kTickerNames[i],
+                      static_cast<unsigned long long>(tickers[i]));
+        out += line;
+    }
+    if (block_cache_hits + block_cache_misses > 0) {
+        std::snprintf(line, sizeof(line), "%-26s %llu\n%-26s %llu\n",
+                      "block_cache.hit", static_cast<unsigned long long>(block_cache_hits),
+                      "block_cache.miss", static_cast<unsigned long long>(block_cache_misses));
+        out += line;
+    }
+    for (size_t i = 0; i < kNumHistograms; ++i) {
+        const HistogramData& h = histograms[i];
+        if (h.count == 0) continue;
+        std::snprintf(line, sizeof(line),
+                      "%-8s count %llu  avg %.2f us  p50 %.2f us  p99 %.2f us  p99.9 %.2f us  max %.2f us\n",
+                      kHistogramNames[i], static_cast<unsigned long long>(h.count),
+                      h.average() / 1000.0, h.p50 / 1000.0, h.p99 / 1000.0, h.p999 / 1000.0,
+                      h.max / 1000.0);
+        out += line;
+    }
+    return out;
+}
+
+Statistics::Statistics() : stripes_(new Stripe[kNumStripes]) {
+}
+
+Statistics::~Statistics() = default;
+
+Statistics::Stripe& Statistics::local_stripe() {
+    // A thread keeps its stripe for life; the hash only spreads threads out
+    thread_local const size_t index = std::hash<std::thread::id>()(std::this_thread::get_id());
+    return stripes_[index % kNumStripes];
+}
+
+size_t Statistics::bucket_index(uint64_t value) {
+    if (value < 4) {
+        return static_cast<size_t>(value);
+    }
+    int bit = 63;
+    while (!(value >> bit)) --bit;
+    // Four buckets per power of two, split by the two bits below the top one
+    size_t index = 4 + static_cast<size_t>(bit - 2) * 4 + ((value >> (bit - 2)) & 3);
+    return std::min(index, kNumBuckets - 1);
+}
+
+uint64_t Statistics::bucket_limit(size_t index) {
+    if (index < 4) {
+        return index + 1;
+    }
+    size_t shift = (index - 4) / 4;
+    return (5 + (index - 4) % 4) << shift;
+}
+
+void Statistics::record_tick(Ticker ticker, uint64_t count) {
+    local_stripe().tickers[static_cast<size_t>(ticker)].fetch_add(count, std::memory_order_relaxed);
+}
+
+void Statistics::record_time(Histogram histogram, uint64_t nanos) {
+    HistogramStripe& h = local_stripe().histograms[static_cast<size_t>(histogram)];
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sum.fetch_add(nanos, std::memory_order_relaxed);
+    h.buckets[bucket_index(nanos)].fetch_add(1, std::memory_order_relaxed);
+    update_min(h.min, nanos);
+    update_max(h.max, nanos);
+}
+
+uint64_t Statistics::ticker(Ticker ticker) const {
+    uint64_t total = 0;
+    for (size_t s = 0; s < kNumStripes; ++s) {
+        total += stripes_[s].tickers[static_cast<size_t>(ticker)].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+HistogramData Statistics::histogram(Histogram histogram) const {
+    HistogramData data;
+    uint64_t buckets[kNumBuckets] = {};
+    uint64_t min = UINT64_MAX;
+    for (size_t s = 0; s < kNumStripes; ++s) {
+        const HistogramStripe& h = stripes_[s].histograms[static_cast<size_t>(histogram)];
+        data.count += h.count.load(std::memory_order_relaxed);
+        data.sum += h.sum.load(std::memory_order_relaxed);
+        min = std::min(min, h.min.load(std::memory_order_relaxed));
+        data.max = std::max(data.max, h.max.load(std::memory_order_relaxed));
+        for (size_t b = 0; b < kNumBuckets; ++b) {
+            buckets[b] += h.buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+    if (data.count == 0) {
+        return data;
+    }
+    data.min = min;
+
+    // Walk the buckets to each percentile and interpolate inside the bucket
+    uint64_t total = 0;
+    for (size_t b = 0; b < kNumBuckets; ++b) {
+        total += buckets[b];
+    }
+    auto percentile = [&](double p) {
+        double rank = total * p / 100.0;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < kNumBuckets; ++b) {
+            if (buckets[b] == 0 || seen + buckets[b] < rank) {
+                seen += buckets[b];
+                continue;
+            }
+            double low = b == 0 ? 0 : static_cast<double>(bucket_limit(b - 1));
+            double high = static_cast<double>(bucket_limit(b));
+            double value = low + (high - low) * (rank - seen) / buckets[b];
+            return std::clamp(value, static_cast<double>(data.min), static_cast<double>(data.max));
+        }
+        return static_cast<double>(data.max);
+    };
+    data.p50 = percentile(50);
+    data.p99 = percentile(99);
+    data.p999 = percentile(99.9);
+    return data;
+}
+
+StatsSnapshot Statistics::snapshot() const {
+    StatsSnapshot snapshot;
+    for (size_t i = 0; i < kNumTickers; ++i) {
+        snapshot.tickers[i] = ticker(static_cast<Ticker>(i));
+    }
+    for (size_t i = 0; i < kNumHistograms; ++i) {
+        snapshot.histograms[i] = histogram(static_cast<Histogram>(i));
+    }
+    return snapshot;
+}
+
+void Statistics::reset() {
+    for (size_t s = 0; s < kNumStripes; ++s) {
+        Stripe& stripe = stripes_[s];
+        for (auto& ticker : stripe.tickers) {
+            ticker.store(0, std::memory_order_relaxed);
+        }
+        for (auto& h : stripe.histograms) {
+            h.count.store(0, std::memory_order_relaxed);
+            h.sum.store(0, std::memory_order_relaxed);
+            h.min.store(UINT64_MAX, std::memory_order_relaxed);
+            h.max.store(0, std::memory_order_relaxed);
+            for (auto& bucket : h.buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+StopWatch::StopWatch(Statistics* stats, Histogram histogram)
+    : stats_(stats), histogram_(histogram), start_(stats ? now_nanos() : 0) {
+}
+
+StopWatch::~StopWatch() {
+    if (stats_) {
+        stats_->record_time(histogram_, elapsed_nanos());
+    }
+}
+
+uint64_t StopWatch::elapsed_nanos() const {
+    return now_nanos() - start_;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Engine event counters
+enum class Ticker : uint32_t {
+    MEMTABLE_HIT,          // gets answered by a memtable, tombstones included
+    MEMTABLE_MISS,         // gets that had to go on to the SSTables
+    SSTABLE_PROBES,        // SSTable lookups made by gets
+    GET_HIT,
+    GET_MISS,
+    BYTES_WRITTEN,         // key and value bytes of puts, deletes and batches
+    BYTES_READ,            // key and value bytes returned by gets
+    WAL_BYTES,
+    WAL_SYNCS,             // one per commit group
+    FLUSH_COUNT,
+    FLUSH_BYTES,           // size of the tables flushes wrote
+    COMPACTION_COUNT,
+    COMPACTION_BYTES_READ,
+    COMPACTION_BYTES_WRITTEN,
+    STALL_COUNT,           // writes that waited for a flush or L0 compaction
+    STALL_MICROS,
+    BLOB_BYTES_WRITTEN,    // by flushes and blob garbage collection
+    BLOB_BYTES_READ,       // records gets read from blob files
+    BLOB_GC_COUNT,
+    BLOB_GC_BYTES,         // live records garbage collection copied
+    COUNT
+};
+
+// Operations whose latency is recorded, in nanoseconds
+enum class Histogram : uint32_t {
+    PUT,
+    GET,
+    REMOVE,
+    WRITE,
+    FLUSH,
+    MULTI_GET,  // per batch; its keys also count as gets in the tickers
+    COUNT
+};
+
+constexpr size_t kNumTickers = static_cast<size_t>(Ticker::COUNT);
+constexpr size_t kNumHistograms = static_cast<size_t>(Histogram::COUNT);
+
+const char* ticker_name(Ticker ticker);
+const char* histogram_name(Histogram histogram);
+
+struct HistogramData {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t min = 0;
+    uint64_t max = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double p999 = 0;
+
+    double average() const { return count ? static_cast<double>(sum) / count : 0; }
+};
+
+// Counters and histograms as of one Statistics::snapshot() call
+struct StatsSnapshot {
+    std::array<uint64_t, kNumTickers> tickers{};
+    std::array<HistogramData, kNumHistograms> histograms{};
+    uint64_t block_cache_hits = 0;
+    uint64_t block_cache_misses = 0;
+
+    uint64_t ticker(Ticker t) const { return tickers[static_cast<size_t>(t)]; }
+    const HistogramData& histogram(Histogram h) const { return histograms[static_cast<size_t>(h)]; }
+
+    // One line per nonzero counter and per histogram that saw any samples
+    std::string to_string() const;
+};
+
+// Cheap enough to leave on: recording is a few relaxed atomic adds on a
+// stripe picked by the calling thread, so threads rarely share a cache
+// line. Reading sums the stripes and is not atomic across counters.
+//
+// Histograms bucket values by power of two with four linear steps in
+// between, so percentiles are accurate to within about 12%.
+class Statistics {
+public:
+    Statistics();
+    ~Statistics();
+    Statistics(const Statistics&) = delete;
+    Statistics& operator=(const Statistics&) = delete;
+
+    void record_tick(Ticker ticker, uint64_t count = 1);
+    void record_time(Histogram histogram, uint64_t nanos);
+
+    uint64_t ticker(Ticker ticker) const;
+    HistogramData histogram(Histogram histogram) const;
+    StatsSnapshot snapshot() const;
+    void reset();
+
+    static constexpr size_t kNumBuckets = 4 + 4 * 40;  // up to 2^42 ns, about 73 minutes
+
+private:
+    struct HistogramStripe {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> min{UINT64_MAX};
+        std::atomic<uint64_t> max{0};
+        std::atomic<uint64_t> buckets[kNumBuckets] = {};
+    };
+
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> tickers[kNumTickers] = {};
+        HistogramStripe histograms[kNumHistograms];
+    };
+
+    static constexpr size_t kNumStripes = 16;
+    std::unique_ptr<Stripe[]> stripes_;
+
+    Stripe& local_stripe();
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_limit(size_t index);
+};
+
+// Records the time from construction to destruction into a histogram;
+// does nothing when stats is null
+class StopWatch {
+public:
+    StopWatch(Statistics* stats, Histogram histogram);
+    ~StopWatch();
+    StopWatch(const StopWatch&) = delete;
+    StopWatch& operator=(const StopWatch&) = delete;
+
+    uint64_t elapsed_nanos() const;
+
+private:
+    Statistics* stats_;
+    Histogram histogram_;
+    uint64_t start_;
+};
@@ -2,6 +2,18 @@
 #include <sstream>
 #include <filesystem>
 #include <algorithm>
+#include <fstream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace utils {
 
@@ -36,7 +48,210 @@ bool file_exists(const std::string& filename) {
 }
 
 size_t file_size(const std::string& filename) {
-    return std::filesystem::file_size(filename);
+    // 0 when there is no such file, rather than throwing
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(filename, ec);
+    return ec ? 0 : size;
+}
+
+uint32_t hash(const char* data, size_t n, uint32_t seed) {
+    // Murmur-like hash, same construction LevelDB uses for its filters
+    const uint32_t m = 0xc6a4a793;
+    const uint32_t r = 24;
+    const char* limit = data + n;
+    uint32_t h = seed ^ static_cast<uint32_t>(n * m);
+
+    while (data + 4 <= limit) {
+        uint32_t w = static_cast<uint8_t>(data[0]) |
+                     (static_cast<uint8_t>(data[1]) << 8) |
+                     (static_cast<uint8_t>(data[2]) << 16) |
+                     (static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 24);
+        data += 4;
+        h += w;
+        h *= m;
+        h ^= (h >> 16);
+    }
+
+    switch (limit - data) {
+        case 3:
+            h += static_cast<uint8_t>(data[2]) << 16;
+            [[fallthrough]];
+        case 2:
+            h += static_cast<uint8_t>(data[1]) << 8;
+            [[fallthrough]];
+        case 1:
+            h += static_cast<uint8_t>(data[0]);
+            h *= m;
+            h ^= (h >> r);
+            break;
+    }
+    return h;
+}
+
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool get_varint(const char*& p, const char* limit, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < limit; shift += 7) {
+        uint64_t byte = static_cast<uint8_t>(*p++);
+        value |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sync_file(const std::string& filename) {
+#ifdef _WIN32
+    int fd = ::_open(filename.c_str(), _O_RDWR | _O_BINARY);
+    bool ok = fd >= 0 && ::_commit(fd) == 0;
+    if (fd >= 0) ::_close(fd);
+    return ok;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    bool ok = fd >= 0 && ::fsync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    return ok;
+#endif
+}
+
+bool sync_dir(const std::string& dirname) {
+#ifdef _WIN32
+    // Directory entries can't be synced on their own here
+    (void)dirname;
+    return true;
+#else
+    int fd = ::open(dirname.c_str(), O_RDONLY | O_DIRECTORY);
+    bool ok = fd >= 0 && ::fsync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    return ok;
+#endif
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+#ifdef _WIN32
+    (void)filename;
+    return false;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    data_ = static_cast<const char*>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+#endif
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+    if (data_ != nullptr) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
+
+void MappedFile::advise(Access access, size_t offset, size_t length) {
+#ifdef _WIN32
+    (void)access;
+    (void)offset;
+    (void)length;
+#else
+    if (data_ == nullptr || offset >= size_) return;
+
+    // madvise needs a page-aligned start
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t start = offset & ~(page - 1);
+    size_t end = (length == 0 || offset + length > size_) ? size_ : offset + length;
+
+    int advice = MADV_NORMAL;
+    if (access == Access::RANDOM) advice = MADV_RANDOM;
+    if (access == Access::SEQUENTIAL) advice = MADV_SEQUENTIAL;
+    ::madvise(const_cast<char*>(data_) + start, end - start, advice);
+#endif
+}
+
+RandomAccessFile::~RandomAccessFile() {
+    close();
+}
+
+bool RandomAccessFile::open(const std::string& filename) {
+    close();
+#ifdef _WIN32
+    if (!file_exists(filename)) {
+        return false;
+    }
+    filename_ = filename;
+    fd_ = 0;
+    return true;
+#else
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ >= 0) {
+        filename_ = filename;
+    }
+    return fd_ >= 0;
+#endif
+}
+
+void RandomAccessFile::close() {
+#ifndef _WIN32
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+#endif
+    fd_ = -1;
+    filename_.clear();
+}
+
+bool RandomAccessFile::read(uint64_t offset, size_t n, std::string& out) const {
+    if (fd_ < 0) {
+        return false;
+    }
+    out.resize(n);
+#ifdef _WIN32
+    std::ifstream file(filename_, std::ios::binary);
+    file.seekg(offset);
+    return n == 0 || static_cast<bool>(file.read(&out[0], n));
+#else
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = ::pread(fd_, &out[done], n - done, static_cast<off_t>(offset + done));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(r);
+    }
+    return true;
+#endif
 }
 
 }
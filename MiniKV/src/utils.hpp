@@ -2,10 +2,70 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 namespace utils {
     std::string trim(const std::string& str);
     std::vector<std::string> split(const std::string& str, char delimiter);
     bool file_exists(const std::string& filename);
     size_t file_size(const std::string& filename);
+    uint32_t hash(const char* data, size_t n, uint32_t seed);
+
+    // Forces what was written to filename onto disk
+    bool sync_file(const std::string& filename);
+    // Forces the entries of a directory onto disk, so files just created in
+    // it or renamed into it survive a crash
+    bool sync_dir(const std::string& dirname);
+
+    // LEB128: seven bits per byte, low bits first, high bit set on every
+    // byte but the last. Values under 128 take one byte.
+    void put_varint(std::string& out, uint64_t value);
+    // Reads a varint at p and advances past it; false if it runs past limit
+    // or is longer than ten bytes
+    bool get_varint(const char*& p, const char* limit, uint64_t& value);
+
+    // Read-only memory mapping of a whole file. open() fails on platforms
+    // without mmap so callers can fall back to stream reads.
+    class MappedFile {
+    public:
+        enum class Access { NORMAL, RANDOM, SEQUENTIAL };
+
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& filename);
+        void close();
+        void advise(Access access, size_t offset = 0, size_t length = 0);
+
+        bool is_open() const { return data_ != nullptr; }
+        const char* data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // Positional reads from a file kept open for the object's lifetime, so
+    // reads keep working after the file is unlinked. Safe to share between
+    // threads.
+    class RandomAccessFile {
+    public:
+        RandomAccessFile() = default;
+        ~RandomAccessFile();
+        RandomAccessFile(const RandomAccessFile&) = delete;
+        RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+        bool open(const std::string& filename);
+        void close();
+        bool read(uint64_t offset, size_t n, std::string& out) const;
+
+        bool is_open() const { return fd_ >= 0; }
+
+    private:
+        int fd_ = -1;
+        std::string filename_;  // reopened per read where pread is unavailable
+    };
 }
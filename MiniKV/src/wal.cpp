@@ -1,109 +1,586 @@
 #include "wal.hpp"
+#include "write_batch.hpp"
+#include "statistics.hpp"
+#include "utils.hpp"
 #include <iostream>
+#include <chrono>
+#include <filesystem>
+#include <iterator>
+#include <random>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
 
-WAL::WAL(const std::string& filename) : filename_(filename) {
-    write_stream_.open(filename_, std::ios::binary | std::ios::app);
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef _WIN32
+int sys_open(const char* path, int flags) { return ::_open(path, flags | O_BINARY, 0644); }
+int sys_write(int fd, const char* p, size_t n) { return ::_write(fd, p, static_cast<unsigned int>(n)); }
+int64_t sys_seek(int fd, int64_t offset) { return ::_lseeki64(fd, offset, SEEK_SET); }
+int64_t sys_tell(int fd) { return ::_lseeki64(fd, 0, SEEK_CUR); }
+int sys_fsync(int fd) { return ::_commit(fd); }
+int sys_close(int fd) { return ::_close(fd); }
+bool sys_preallocate(int, size_t) { return false; }
+#else
+int sys_open(const char* path, int flags) { return ::open(path, flags, 0644); }
+ssize_t sys_write(int fd, const char* p, size_t n) { return ::write(fd, p, n); }
+int64_t sys_seek(int fd, int64_t offset) { return ::lseek(fd, offset, SEEK_SET); }
+int64_t sys_tell(int fd) { return ::lseek(fd, 0, SEEK_CUR); }
+int sys_close(int fd) { return ::close(fd); }
+#ifdef __linux__
+// Preallocated segments keep their size, so only the data needs syncing
+int sys_fsync(int fd) { return ::fdatasync(fd); }
+bool sys_preallocate(int fd, size_t size) { return ::fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0; }
+#else
+int sys_fsync(int fd) { return ::fsync(fd); }
+bool sys_preallocate(int, size_t) { return false; }
+#endif
+#endif
+
+// Upper bound on how much a leader gathers into one group
+constexpr size_t kMaxGroupBytes = 1 << 20;
+
+// Set on the opcode of records that carry a sequence number; the u64 follows
+// the opcode and is filled in by the leader once the order is known
+constexpr uint8_t kSequencedFlag = 0x80;
+constexpr size_t kSequenceOffset = 1;
+
+// Segment header: magic, then the segment id. Records follow, each framed
+// as [checksum u32][length u32][record]. Records store lengths as varints
+// in "MKVWAL02" segments; "MKVWAL01" segments and files from before
+// headers use u16 lengths and are still read.
+constexpr size_t kMagicSize = 8;
+constexpr char kSegmentMagic[kMagicSize + 1] = "MKVWAL02";
+constexpr char kSegmentMagicV1[kMagicSize + 1] = "MKVWAL01";
+constexpr size_t kSegmentHeaderSize = kMagicSize + sizeof(uint64_t);
+constexpr size_t kFrameHeaderSize = 2 * sizeof(uint32_t);
+
+// Record format of a log file's contents
+enum class LogFormat { UNFRAMED, FRAMED_V1, CURRENT };
+
+LogFormat log_format(std::string_view data) {
+    if (data.size() >= kSegmentHeaderSize) {
+        if (data.compare(0, kMagicSize, kSegmentMagic) == 0) return LogFormat::CURRENT;
+        if (data.compare(0, kMagicSize, kSegmentMagicV1) == 0) return LogFormat::FRAMED_V1;
+    }
+    return LogFormat::UNFRAMED;
+}
+
+uint32_t frame_checksum(const char* data, size_t n, uint64_t segment_id) {
+    return utils::hash(data, n, static_cast<uint32_t>(segment_id ^ (segment_id >> 32)));
+}
+
+// Fills in the frame header reserved at out[frame] for the record after it
+void seal_frame(std::string& out, size_t frame, uint64_t segment_id) {
+    size_t start = frame + kFrameHeaderSize;
+    uint32_t length = static_cast<uint32_t>(out.size() - start);
+    uint32_t checksum = frame_checksum(&out[start], length, segment_id);
+    std::memcpy(&out[frame], &checksum, sizeof(checksum));
+    std::memcpy(&out[frame + sizeof(checksum)], &length, sizeof(length));
+}
+
+uint64_t new_segment_id() {
+    static std::mutex mutex;
+    static std::mt19937_64 rng(std::random_device{}() ^
+                               static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::lock_guard<std::mutex> lock(mutex);
+    return rng();
+}
+
+bool write_fully(int fd, std::string_view data) {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        auto n = sys_write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+}
+
+WAL::WAL(const std::string& filename, uint64_t last_sequence, Statistics* stats,
+         size_t preallocate_size)
+    : filename_(filename), failed_(false), last_sequence_(last_sequence), stats_(stats),
+      preallocate_size_(preallocate_size) {
+    Segment segment = open_segment(filename_, "", false);
+    fd_ = segment.fd;
+    segment_id_ = segment.id;
+}
+
+WAL::Segment WAL::open_segment(const std::string& filename, const std::string& reuse,
+                               bool truncate) const {
+    Segment segment;
+    segment.id = new_segment_id();
+    std::string header(kSegmentMagic, kMagicSize);
+    header.append(reinterpret_cast<const char*>(&segment.id), sizeof(segment.id));
+
+    // Stamp a retired segment with the new id before it takes the new name,
+    // so its old records can never be read back as this segment's
+    if (!reuse.empty()) {
+        int fd = sys_open(reuse.c_str(), O_WRONLY);
+        std::error_code ec;
+        if (fd >= 0 && sys_seek(fd, 0) == 0 && write_fully(fd, header) && sys_fsync(fd) == 0) {
+            std::filesystem::rename(reuse, filename, ec);
+            if (!ec) {
+                segment.fd = fd;
+            }
+        }
+        if (segment.fd < 0) {
+            if (fd >= 0) sys_close(fd);
+            std::filesystem::remove(reuse, ec);
+        }
+    }
+
+    // Otherwise open the file, keeping whatever it already holds
+    size_t offset = kSegmentHeaderSize;
+    if (segment.fd < 0) {
+        std::error_code ec;
+        bool existing = !truncate && std::filesystem::file_size(filename, ec) > 0 && !ec;
+        if (existing) {
+            utils::MappedFile mapped;
+            std::string contents;
+            std::string_view data;
+            if (mapped.open(filename)) {
+                data = std::string_view(mapped.data(), mapped.size());
+            } else {
+                std::ifstream in(filename, std::ios::binary);
+                contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                data = contents;
+            }
+            if (log_format(data) == LogFormat::CURRENT) {
+                std::memcpy(&segment.id, data.data() + kMagicSize, sizeof(segment.id));
+                offset = scan(data, [](const EntryView&) { return true; });
+            } else {
+                // An older format: rewrite its readable records in the
+                // current one so appends can follow them
+                std::string converted = header;
+                scan(data, [&](const EntryView& view) {
+                    LogEntry entry{view.op_type, std::string(view.key), std::string(view.value), {}, view.sequence};
+                    for (const auto& op : view.batch) {
+                        entry.batch.push_back({op.op_type, std::string(op.key), std::string(op.value), {}, 0});
+                    }
+                    size_t frame = converted.size();
+                    converted.append(kFrameHeaderSize, '\0');
+                    encode_entry(entry, converted, entry.sequence != 0);
+                    seal_frame(converted, frame, segment.id);
+                    return true;
+                });
+                mapped.close();
+
+                std::string temp = filename + ".tmp";
+                int fd = sys_open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+                bool ok = fd >= 0 && write_fully(fd, converted) && sys_fsync(fd) == 0;
+                if (fd >= 0) sys_close(fd);
+                if (ok) std::filesystem::rename(temp, filename, ec);
+                if (!ok || ec) {
+                    std::filesystem::remove(temp, ec);
+                    return segment;
+                }
+                offset = converted.size();
+            }
+        }
+
+        segment.fd = sys_open(filename.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0));
+        if (segment.fd >= 0 && !existing && !write_fully(segment.fd, header)) {
+            sys_close(segment.fd);
+            segment.fd = -1;
+        }
+    }
+    if (segment.fd < 0) {
+        return segment;
+    }
+
+    // Zero-filled space past the end reads as the end of the log
+    if (preallocate_size_ > 0) {
+        sys_preallocate(segment.fd, preallocate_size_);
+    }
+    // The new name must survive a crash before records are acknowledged
+    // under it
+    std::string dir = std::filesystem::path(filename).parent_path().string();
+    if (sys_seek(segment.fd, static_cast<int64_t>(offset)) < 0 || !utils::sync_dir(dir.empty() ? "." : dir)) {
+        sys_close(segment.fd);
+        segment.fd = -1;
+    }
+    return segment;
 }
 
 WAL::~WAL() {
     close();
 }
 
-bool WAL::write_put(const std::string& key, const std::string& value) {
-    LogEntry entry{OpType::PUT, key, value};
-    return write_entry(entry);
+bool WAL::write_put(const std::string& key, const std::string& value, const ApplyFn& apply) {
+    LogEntry entry{OpType::PUT, key, value, {}};
+    std::string record;
+    encode_entry(entry, record, true);
+    return append(record, 1, apply);
 }
 
-bool WAL::write_delete(const std::string& key) {
-    LogEntry entry{OpType::DELETE, key, ""};
-    return write_entry(entry);
+bool WAL::write_delete(const std::string& key, const ApplyFn& apply) {
+    LogEntry entry{OpType::DELETE, key, "", {}};
+    std::string record;
+    encode_entry(entry, record, true);
+    return append(record, 1, apply);
 }
 
-bool WAL::write_entry(const LogEntry& entry) {
-    std::lock_guard<std::mutex> lock(mutex_);
+bool WAL::write_batch(const WriteBatch& batch, const ApplyFn& apply) {
+    std::string record;
+    record.push_back(static_cast<char>(static_cast<uint8_t>(OpType::BATCH) | kSequencedFlag));
+    record.append(sizeof(uint64_t), '\0');
+    encode_batch(batch.entries(), record);
+    return append(record, static_cast<uint32_t>(batch.count()), apply);
+}
 
-    if (!write_stream_.is_open()) {
-        return false;
+void WAL::encode_batch(const std::vector<LogEntry>& ops, std::string& out) {
+    // Operation count, payload length, payload
+    std::string payload;
+    for (const auto& op : ops) {
+        encode_entry(op, payload);
     }
+    utils::put_varint(out, ops.size());
+    utils::put_varint(out, payload.size());
+    out.append(payload);
+}
 
-    // Write opcode
-    write_stream_.write(reinterpret_cast<const char*>(&entry.op_type), sizeof(entry.op_type));
+void WAL::encode_entry(const LogEntry& entry, std::string& out, bool sequenced) {
+    // Write opcode, and the sequence if it is a top-level record. New
+    // records get theirs from the leader; until then it is zero.
+    uint8_t opcode = static_cast<uint8_t>(entry.op_type);
+    out.push_back(static_cast<char>(sequenced ? opcode | kSequencedFlag : opcode));
+    if (sequenced) {
+        out.append(reinterpret_cast<const char*>(&entry.sequence), sizeof(entry.sequence));
+    }
+    if (entry.op_type == OpType::BATCH) {
+        encode_batch(entry.batch, out);
+        return;
+    }
 
     // Write key length and key
-    uint16_t key_len = static_cast<uint16_t>(entry.key.length());
-    write_stream_.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
-    write_stream_.write(entry.key.c_str(), key_len);
+    utils::put_varint(out, entry.key.length());
+    out.append(entry.key);
 
     // Write value length and value (for PUT operations)
     if (entry.op_type == OpType::PUT) {
-        uint16_t val_len = static_cast<uint16_t>(entry.value.length());
-        write_stream_.write(reinterpret_cast<const char*>(&val_len), sizeof(val_len));
-        write_stream_.write(entry.value.c_str(), val_len);
+        utils::put_varint(out, entry.value.length());
+        out.append(entry.value);
+    }
+}
+
+bool WAL::append(const std::string& record, uint32_t count, const ApplyFn& apply) {
+    Writer w;
+    w.record = &record;
+    w.apply = &apply;
+
+    // Queue order is log order, so number the record as it joins the queue
+    std::unique_lock<std::mutex> lock(mutex_);
+    w.sequence = last_sequence_ + 1;
+    last_sequence_ += count;
+    writers_.push_back(&w);
+    while (!w.done && &w != writers_.front()) {
+        w.cv.wait(lock);
+    }
+    if (w.done) {
+        return w.ok;  // a leader committed our record for us
+    }
+
+    // We are the leader: gather queued records up to the next barrier
+    std::vector<Writer*> group;
+    group_buffer_.clear();
+    for (Writer* writer : writers_) {
+        if (writer->record == nullptr) break;
+        if (!group.empty() && group_buffer_.size() + writer->record->size() > kMaxGroupBytes) break;
+        // The checksum covers the sequence, so the frame is sealed here
+        size_t frame = group_buffer_.size();
+        group_buffer_.append(kFrameHeaderSize, '\0');
+        size_t start = group_buffer_.size();
+        group_buffer_.append(*writer->record);
+        std::memcpy(&group_buffer_[start + kSequenceOffset], &writer->sequence, sizeof(uint64_t));
+        seal_frame(group_buffer_, frame, segment_id_);
+        group.push_back(writer);
+    }
+    int fd = failed_ ? -1 : fd_;
+    lock.unlock();
+
+    // Followers stay queued behind us, so the fd and buffer are ours until we relock
+    int64_t start = fd >= 0 ? sys_tell(fd) : -1;
+    bool written = start >= 0 && write_fully(fd, group_buffer_);
+    bool ok = written && sys_fsync(fd) == 0;
+    if (ok) {
+        if (stats_) {
+            stats_->record_tick(Ticker::WAL_BYTES, group_buffer_.size());
+            stats_->record_tick(Ticker::WAL_SYNCS);
+        }
+        for (Writer* writer : group) {
+            if (*writer->apply) {
+                (*writer->apply)(writer->sequence);
+            }
+        }
+    }
+
+    lock.lock();
+    if (!ok && fd >= 0) {
+        // A later group appended after a torn frame would never be replayed,
+        // so the next one starts where this one did. After a failed sync
+        // nothing written since the last good one can be trusted; the log
+        // refuses writes until it is reopened.
+        if (written || sys_seek(fd, start) != start) {
+            failed_ = true;
+        }
     }
+    for (Writer* writer : group) {
+        writer->ok = ok;
+        writer->done = true;
+        if (writer != &w) {
+            writer->cv.notify_one();
+        }
+        writers_.pop_front();
+    }
+    signal_front();
+    return ok;
+}
+
+void WAL::run_exclusive(const std::function<void()>& fn) {
+    Writer w;
 
-    write_stream_.flush();
-    return write_stream_.good();
+    std::unique_lock<std::mutex> lock(mutex_);
+    writers_.push_back(&w);
+    while (&w != writers_.front()) {
+        w.cv.wait(lock);
+    }
+    lock.unlock();
+
+    fn();
+
+    lock.lock();
+    writers_.pop_front();
+    signal_front();
+}
+
+void WAL::signal_front() {
+    if (!writers_.empty()) {
+        writers_.front()->cv.notify_one();
+    }
 }
 
 std::vector<WAL::LogEntry> WAL::read_all() {
+    return read_file(filename_);
+}
+
+std::vector<WAL::LogEntry> WAL::read_file(const std::string& filename) {
     std::vector<LogEntry> entries;
-    std::ifstream read_stream(filename_, std::ios::binary);
+    replay_file(filename, [&entries](const EntryView& view) {
+        LogEntry entry{view.op_type, std::string(view.key), std::string(view.value), {}, view.sequence};
+        for (const auto& op : view.batch) {
+            entry.batch.push_back({op.op_type, std::string(op.key), std::string(op.value), {}, 0});
+        }
+        entries.push_back(std::move(entry));
+        return true;
+    });
+    return entries;
+}
 
-    if (!read_stream.is_open()) {
-        return entries;
+bool WAL::replay_file(const std::string& filename, const ReplayFn& fn) {
+    // Map the log where we can; otherwise read it whole
+    utils::MappedFile mapped;
+    std::string contents;
+    std::string_view data;
+    if (mapped.open(filename)) {
+        mapped.advise(utils::MappedFile::Access::SEQUENTIAL);
+        data = std::string_view(mapped.data(), mapped.size());
+    } else {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open()) {
+            return false;
+        }
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = contents;
     }
 
-    LogEntry entry;
-    while (read_entry(read_stream, entry)) {
-        entries.push_back(entry);
+    scan(data, fn);
+    return true;
+}
+
+size_t WAL::scan(std::string_view data, const ReplayFn& fn) {
+    // One entry reused throughout, so a batch's vector is only grown once
+    EntryView entry;
+    const char* begin = data.data();
+    const char* limit = begin + data.size();
+
+    LogFormat format = log_format(data);
+    if (format == LogFormat::UNFRAMED) {
+        // Written before segment headers: records back to back
+        const char* p = begin;
+        const char* next = p;
+        while (next < limit && decode_entry(next, limit, false, entry)) {
+            p = next;
+            if (!fn(entry)) break;
+        }
+        return static_cast<size_t>(p - begin);
     }
 
-    return entries;
+    bool varint = format == LogFormat::CURRENT;
+    uint64_t segment_id;
+    std::memcpy(&segment_id, begin + kMagicSize, sizeof(segment_id));
+    const char* p = begin + kSegmentHeaderSize;
+    while (static_cast<size_t>(limit - p) >= kFrameHeaderSize) {
+        uint32_t checksum, length;
+        std::memcpy(&checksum, p, sizeof(checksum));
+        std::memcpy(&length, p + sizeof(checksum), sizeof(length));
+        const char* record = p + kFrameHeaderSize;
+        if (length == 0 || length > static_cast<size_t>(limit - record) ||
+            frame_checksum(record, length, segment_id) != checksum) {
+            break;
+        }
+        const char* end = record + length;
+        if (!decode_entry(record, end, varint, entry) || record != end) {
+            break;
+        }
+        p = end;
+        if (!fn(entry)) break;
+    }
+    return static_cast<size_t>(p - begin);
 }
 
-bool WAL::read_entry(std::ifstream& stream, LogEntry& entry) {
-    // Read opcode
-    if (!stream.read(reinterpret_cast<char*>(&entry.op_type), sizeof(entry.op_type))) {
+bool WAL::decode_entry(const char*& p, const char* limit, bool varint, EntryView& entry) {
+    auto read = [&p, limit](void* out, size_t n) {
+        if (static_cast<size_t>(limit - p) < n) {
+            return false;
+        }
+        std::memcpy(out, p, n);
+        p += n;
+        return true;
+    };
+    auto read_length = [&](uint64_t& length) {
+        if (varint) {
+            return utils::get_varint(p, limit, length);
+        }
+        uint16_t fixed;
+        if (!read(&fixed, sizeof(fixed))) return false;
+        length = fixed;
+        return true;
+    };
+    auto read_view = [&p, limit](std::string_view& out, uint64_t n) {
+        if (static_cast<size_t>(limit - p) < n) {
+            return false;
+        }
+        out = std::string_view(p, n);
+        p += n;
+        return true;
+    };
+
+    // Read opcode, and the sequence number if the record has one
+    uint8_t opcode;
+    if (!read(&opcode, sizeof(opcode))) {
         return false;
     }
-
-    // Read key length and key
-    uint16_t key_len;
-    if (!stream.read(reinterpret_cast<char*>(&key_len), sizeof(key_len))) {
+    entry.op_type = static_cast<OpType>(opcode & ~kSequencedFlag);
+    if (entry.op_type != OpType::PUT && entry.op_type != OpType::DELETE &&
+        entry.op_type != OpType::BATCH) {
+        return false;
+    }
+    entry.sequence = 0;
+    if ((opcode & kSequencedFlag) && !read(&entry.sequence, sizeof(entry.sequence))) {
         return false;
     }
 
-    entry.key.resize(key_len);
-    if (!stream.read(&entry.key[0], key_len)) {
+    entry.batch.clear();
+    entry.key = {};
+    entry.value = {};
+    if (entry.op_type == OpType::BATCH) {
+        uint64_t count, payload_len;
+        std::string_view payload;
+        if (varint) {
+            if (!utils::get_varint(p, limit, count) || !utils::get_varint(p, limit, payload_len)) {
+                return false;
+            }
+        } else {
+            uint32_t fixed_count, fixed_len;
+            if (!read(&fixed_count, sizeof(fixed_count)) || !read(&fixed_len, sizeof(fixed_len))) {
+                return false;
+            }
+            count = fixed_count;
+            payload_len = fixed_len;
+        }
+
+        // The whole frame must be present, otherwise none of it is applied
+        if (!read_view(payload, payload_len)) {
+            return false;
+        }
+
+        const char* q = payload.data();
+        const char* payload_limit = q + payload.size();
+        EntryView op;
+        while (entry.batch.size() < count && q < payload_limit && decode_entry(q, payload_limit, varint, op)) {
+            if (op.op_type == OpType::BATCH || op.sequence != 0) {
+                return false;
+            }
+            entry.batch.push_back(op);
+        }
+        return entry.batch.size() == count;
+    }
+
+    // Read key length and key
+    uint64_t key_len;
+    if (!read_length(key_len) || !read_view(entry.key, key_len)) {
         return false;
     }
 
     // Read value for PUT operations
     if (entry.op_type == OpType::PUT) {
-        uint16_t val_len;
-        if (!stream.read(reinterpret_cast<char*>(&val_len), sizeof(val_len))) {
+        uint64_t val_len;
+        if (!read_length(val_len) || !read_view(entry.value, val_len)) {
             return false;
         }
+    }
 
-        entry.value.resize(val_len);
-        if (!stream.read(&entry.value[0], val_len)) {
-            return false;
-        }
-    } else {
-        entry.value.clear();
+    return true;
+}
+
+bool WAL::switch_file(const std::string& filename, const std::string& reuse) {
+    Segment segment = open_segment(filename, reuse, true);
+    if (segment.fd < 0) {
+        return false;
     }
 
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) {
+        sys_close(fd_);
+    }
+    fd_ = segment.fd;
+    segment_id_ = segment.id;
+    filename_ = filename;
     return true;
 }
 
+const std::string& WAL::filename() const {
+    return filename_;
+}
+
 void WAL::clear() {
     std::lock_guard<std::mutex> lock(mutex_);
-    write_stream_.close();
-    write_stream_.open(filename_, std::ios::binary | std::ios::trunc);
+    if (fd_ >= 0) {
+        sys_close(fd_);
+    }
+    Segment segment = open_segment(filename_, "", true);
+    fd_ = segment.fd;
+    segment_id_ = segment.id;
 }
 
 void WAL::close() {
-    if (write_stream_.is_open()) {
-        write_stream_.close();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) {
+        sys_close(fd_);
+        fd_ = -1;
     }
 }
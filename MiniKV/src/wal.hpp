@@ -3,35 +3,130 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <deque>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <string_view>
 
+class WriteBatch;
+class Statistics;
+
+// Log segment. A segment opens with a header holding a random id, and each
+// record is framed with its length and a checksum seeded by that id, so the
+// zeros of preallocated space and records left over from a recycled file's
+// previous use both read as the end of the log. Key and value lengths are
+// varints. Logs in older formats are still read, and converted when opened
+// for appending.
 class WAL {
 public:
     enum class OpType : uint8_t {
         PUT = 0x01,
-        DELETE = 0x02
+        DELETE = 0x02,
+        BATCH = 0x03
     };
 
     struct LogEntry {
         OpType op_type;
         std::string key;
         std::string value;
+        std::vector<LogEntry> batch;  // operations of a BATCH record
+        uint64_t sequence = 0;        // 0 for records logged before sequencing
+    };
+
+    // A record decoded in place by replay_file. The views point into the
+    // log's mapping and only live until the callback returns.
+    struct EntryView {
+        OpType op_type;
+        std::string_view key;
+        std::string_view value;
+        std::vector<EntryView> batch;
+        uint64_t sequence = 0;
     };
 
-    explicit WAL(const std::string& filename);
+    // Return false to stop the replay
+    using ReplayFn = std::function<bool(const EntryView& entry)>;
+
+    // Called with the sequence number of the record's first operation; a
+    // batch's operations are numbered consecutively from there
+    using ApplyFn = std::function<void(uint64_t sequence)>;
+
+    // Opens filename for appending after its last intact record, creating it
+    // if needed. stats, when given, counts the bytes written and the syncs.
+    // preallocate_size reserves that much of each segment up front so
+    // appends don't change the file size and a sync writes no metadata.
+    explicit WAL(const std::string& filename, uint64_t last_sequence = 0,
+                 Statistics* stats = nullptr, size_t preallocate_size = 0);
     ~WAL();
 
-    bool write_put(const std::string& key, const std::string& value);
-    bool write_delete(const std::string& key);
+    // Appends are group-committed: concurrent callers queue up, the first one
+    // becomes leader and writes every queued record with a single write() and
+    // fsync(). Sequence numbers are handed out in log order. `apply` runs
+    // after the record is durable, in log order, before the next group
+    // starts, so callers can update in-memory state from it.
+    bool write_put(const std::string& key, const std::string& value,
+                   const ApplyFn& apply = {});
+    bool write_delete(const std::string& key, const ApplyFn& apply = {});
+    // Logs the whole batch as one framed record; a torn frame is dropped on read
+    bool write_batch(const WriteBatch& batch, const ApplyFn& apply = {});
     std::vector<LogEntry> read_all();
+    static std::vector<LogEntry> read_file(const std::string& filename);
+    // Maps the log and hands every intact record to fn, in order, without
+    // copying keys or values. Stops at a torn or unknown record. False if
+    // the file can't be read.
+    static bool replay_file(const std::string& filename, const ReplayFn& fn);
+
+    // Runs fn once every earlier append has been written and applied, holding
+    // back later appends until it returns. clear() may be called from fn.
+    void run_exclusive(const std::function<void()>& fn);
+
+    // Directs later appends to a new log file; call it from run_exclusive.
+    // Given a retired segment in reuse, that file is taken over and renamed
+    // instead of allocating a new one; its old records are invalidated first.
+    bool switch_file(const std::string& filename, const std::string& reuse = "");
+    const std::string& filename() const;
+
     void clear();
     void close();
 
 private:
+    struct Writer {
+        const std::string* record = nullptr;  // nullptr marks a run_exclusive barrier
+        const ApplyFn* apply = nullptr;
+        uint64_t sequence = 0;
+        bool ok = false;
+        bool done = false;
+        std::condition_variable cv;
+    };
+
+    // An open segment file, positioned for the next append
+    struct Segment {
+        int fd = -1;
+        uint64_t id = 0;
+    };
+
     std::string filename_;
-    std::ofstream write_stream_;
+    int fd_;
+    uint64_t segment_id_;
+    // A torn write couldn't be undone or a sync failed; appends fail from
+    // then on
+    bool failed_;
     std::mutex mutex_;
+    std::deque<Writer*> writers_;
+    std::string group_buffer_;  // only touched by the current leader
+    uint64_t last_sequence_;
+    Statistics* stats_;
+    size_t preallocate_size_;
 
-    bool write_entry(const LogEntry& entry);
-    bool read_entry(std::ifstream& stream, LogEntry& entry);
+    bool append(const std::string& record, uint32_t count, const ApplyFn& apply);
+    Segment open_segment(const std::string& filename, const std::string& reuse, bool truncate) const;
+    // Calls fn on each intact record of a whole log file; returns the length
+    // of the intact prefix
+    static size_t scan(std::string_view data, const ReplayFn& fn);
+    void signal_front();
+    static void encode_entry(const LogEntry& entry, std::string& out, bool sequenced = false);
+    static void encode_batch(const std::vector<LogEntry>& ops, std::string& out);
+    // varint selects the current length encoding over the older u16 one
+    static bool decode_entry(const char*& p, const char* limit, bool varint, EntryView& entry);
 };
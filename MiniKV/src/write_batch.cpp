@@ -0,0 +1,25 @@
+#include "write_batch.hpp"
+
+void WriteBatch::put(const std::string& key, const std::string& value) {
+    entries_.push_back({WAL::OpType::PUT, key, value, {}});
+}
+
+void WriteBatch::remove(const std::string& key) {
+    entries_.push_back({WAL::OpType::DELETE, key, "", {}});
+}
+
+void WriteBatch::clear() {
+    entries_.clear();
+}
+
+size_t WriteBatch::count() const {
+    return entries_.size();
+}
+
+bool WriteBatch::empty() const {
+    return entries_.empty();
+}
+
+const std::vector<WAL::LogEntry>& WriteBatch::entries() const {
+    return entries_;
+}
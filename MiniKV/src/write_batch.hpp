@@ -0,0 +1,21 @@
+#pragma once
+
+#include "wal.hpp"
+#include <string>
+#include <vector>
+
+// Collects puts and deletes that KVStore::write logs as one WAL record and
+// applies to the memtable atomically. Later operations on the same key win.
+class WriteBatch {
+public:
+    void put(const std::string& key, const std::string& value);
+    void remove(const std::string& key);
+    void clear();
+
+    size_t count() const;
+    bool empty() const;
+    const std::vector<WAL::LogEntry>& entries() const;
+
+private:
+    std::vector<WAL::LogEntry> entries_;
+};
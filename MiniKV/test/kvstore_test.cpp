@@ -1,6 +1,14 @@
 #include <gtest/gtest.h>
 #include "kvstore.hpp"
+#include "write_batch.hpp"
+#include "wal.hpp"
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <map>
+#include <cstdio>
 
 class KVStoreTest : public ::testing::Test {
 protected:
@@ -63,3 +71,691 @@ TEST_F(KVStoreTest, Persistence) {
     EXPECT_TRUE(store->get("persistent_key", value));
     EXPECT_EQ(value, "persistent_value");
 }
+
+TEST_F(KVStoreTest, ConcurrentPuts) {
+    const int num_threads = 8;
+    const int per_thread = 100;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < per_thread; ++i) {
+                std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                EXPECT_TRUE(store->put(key, "value" + std::to_string(i)));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Everything must also survive a restart through WAL replay
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+
+    for (int t = 0; t < num_threads; ++t) {
+        for (int i = 0; i < per_thread; ++i) {
+            std::string value;
+            EXPECT_TRUE(store->get("t" + std::to_string(t) + "_" + std::to_string(i), value));
+            EXPECT_EQ(value, "value" + std::to_string(i));
+        }
+    }
+}
+
+TEST_F(KVStoreTest, WriteBatchAppliesAndPersists) {
+    EXPECT_TRUE(store->put("key1", "old"));
+
+    WriteBatch batch;
+    batch.put("key1", "value1");
+    batch.put("key2", "value2");
+    batch.remove("key2");
+    batch.put("key3", "value3");
+    EXPECT_TRUE(store->write(batch));
+
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+
+    std::string value;
+    EXPECT_TRUE(store->get("key1", value));
+    EXPECT_EQ(value, "value1");
+    EXPECT_FALSE(store->get("key2", value));
+    EXPECT_TRUE(store->get("key3", value));
+    EXPECT_EQ(value, "value3");
+}
+
+TEST_F(KVStoreTest, DeleteShadowsFlushedValue) {
+    EXPECT_TRUE(store->put("key1", "value1"));
+    store->flush_memtable();
+    EXPECT_TRUE(store->remove("key1"));
+
+    std::string value;
+    EXPECT_FALSE(store->get("key1", value));
+
+    // The tombstone must also win once it is flushed and reloaded
+    store->flush_memtable();
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+    EXPECT_FALSE(store->get("key1", value));
+}
+
+TEST_F(KVStoreTest, BackgroundFlushKeepsDataReadable) {
+    store.reset();
+    Options options;
+    options.memtable_size_limit = 4 * 1024;
+    store = std::make_unique<KVStore>(test_dir, options);
+
+    const std::string payload(100, 'v');
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_TRUE(store->put("key" + std::to_string(i), payload + std::to_string(i)));
+    }
+
+    std::string value;
+    for (int i = 0; i < 2000; i += 37) {
+        ASSERT_TRUE(store->get("key" + std::to_string(i), value));
+        EXPECT_EQ(value, payload + std::to_string(i));
+    }
+
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir, options);
+    for (int i = 0; i < 2000; i += 37) {
+        ASSERT_TRUE(store->get("key" + std::to_string(i), value));
+        EXPECT_EQ(value, payload + std::to_string(i));
+    }
+}
+
+TEST_F(KVStoreTest, CompactionMergesLevels) {
+    store.reset();
+    Options options;
+    options.memtable_size_limit = 4 * 1024;
+    options.max_bytes_for_level_base = 64 * 1024;
+    options.target_file_size = 16 * 1024;
+    store = std::make_unique<KVStore>(test_dir, options);
+
+    // Several rounds of overwrites, then delete every third key
+    const std::string payload(100, 'v');
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            ASSERT_TRUE(store->put("key" + std::to_string(i), payload + std::to_string(round)));
+        }
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        ASSERT_TRUE(store->remove("key" + std::to_string(i)));
+    }
+
+    // Manual compaction leaves everything in a single level below L0
+    store->compact();
+    int populated = 0;
+    for (int level = 1; level < options.num_levels; ++level) {
+        populated += store->num_tables_at_level(level) > 0;
+    }
+    EXPECT_EQ(store->num_tables_at_level(0), 0u);
+    EXPECT_EQ(populated, 1);
+
+    auto check = [&] {
+        std::string value;
+        for (int i = 0; i < 1000; ++i) {
+            if (i % 3 == 0) {
+                EXPECT_FALSE(store->get("key" + std::to_string(i), value));
+            } else {
+                ASSERT_TRUE(store->get("key" + std::to_string(i), value));
+                EXPECT_EQ(value, payload + "2");
+            }
+        }
+    };
+    check();
+
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir, options);
+    EXPECT_EQ(store->num_tables_at_level(0), 0u);
+    check();
+
+    // Once everything sits in one level the overwritten versions and
+    // tombstones are gone: about 667 live keys of ~110 bytes each
+    uint64_t bytes = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(test_dir)) {
+        if (entry.path().extension() == ".sst") {
+            bytes += entry.file_size();
+        }
+    }
+    EXPECT_LT(bytes, 100u * 1024);
+}
+
+TEST_F(KVStoreTest, IteratorMergesAllLayers) {
+    store.reset();
+    Options options;
+    options.memtable_size_limit = 2 * 1024;
+    options.block_size = 256;
+    store = std::make_unique<KVStore>(test_dir, options);
+
+    // Spread versions of the same keys over compacted levels, L0 tables and
+    // the memtable, keeping the expected contents in a map
+    std::map<std::string, std::string> model;
+    auto key_of = [](int i) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "key%04d", i);
+        return std::string(buf);
+    };
+    for (int round = 0; round < 4; ++round) {
+        for (int i = round; i < 600; i += round + 1) {
+            std::string value = "v" + std::to_string(round) + "_" + std::to_string(i);
+            ASSERT_TRUE(store->put(key_of(i), value));
+            model[key_of(i)] = value;
+        }
+        for (int i = round * 7; i < 600; i += 11) {
+            ASSERT_TRUE(store->remove(key_of(i)));
+            model.erase(key_of(i));
+        }
+        if (round == 1) {
+            store->compact();
+        }
+    }
+
+    auto it = store->new_iterator();
+    auto expected = model.begin();
+    for (it->seek_to_first(); it->valid(); it->next(), ++expected) {
+        ASSERT_NE(expected, model.end());
+        EXPECT_EQ(it->key(), expected->first);
+        EXPECT_EQ(it->value(), expected->second);
+    }
+    EXPECT_EQ(expected, model.end());
+
+    auto rexpected = model.rbegin();
+    for (it->seek_to_last(); it->valid(); it->prev(), ++rexpected) {
+        ASSERT_NE(rexpected, model.rend());
+        EXPECT_EQ(it->key(), rexpected->first);
+        EXPECT_EQ(it->value(), rexpected->second);
+    }
+    EXPECT_EQ(rexpected, model.rend());
+
+    // Change direction in the middle of the key space
+    it->seek("key0300");
+    auto pos = model.lower_bound("key0300");
+    ASSERT_TRUE(it->valid());
+    EXPECT_EQ(it->key(), pos->first);
+    it->next();
+    it->next();
+    it->prev();
+    EXPECT_EQ(it->key(), std::next(pos)->first);
+    it->prev();
+    it->prev();
+    EXPECT_EQ(it->key(), std::prev(pos)->first);
+    it->next();
+    EXPECT_EQ(it->key(), pos->first);
+}
+
+TEST_F(KVStoreTest, IteratorRespectsBounds) {
+    for (const char* key : {"apple", "apricot", "banana", "blueberry", "cherry"}) {
+        ASSERT_TRUE(store->put(key, std::string("fruit:") + key));
+    }
+    store->flush_memtable();
+    ASSERT_TRUE(store->put("avocado", "fruit:avocado"));
+    ASSERT_TRUE(store->remove("apricot"));
+
+    ReadOptions prefix;
+    prefix.prefix = "a";
+    auto it = store->new_iterator(prefix);
+    std::vector<std::string> keys;
+    for (it->seek_to_first(); it->valid(); it->next()) {
+        keys.emplace_back(it->key());
+    }
+    EXPECT_EQ(keys, (std::vector<std::string>{"apple", "avocado"}));
+
+    it->seek_to_last();
+    ASSERT_TRUE(it->valid());
+    EXPECT_EQ(it->key(), "avocado");
+    EXPECT_EQ(it->value(), "fruit:avocado");
+
+    ReadOptions bounded;
+    bounded.upper_bound = "blueberry";
+    it = store->new_iterator(bounded);
+    keys.clear();
+    for (it->seek_to_last(); it->valid(); it->prev()) {
+        keys.emplace_back(it->key());
+    }
+    EXPECT_EQ(keys, (std::vector<std::string>{"banana", "avocado", "apple"}));
+
+    // Writes after the iterator was created are not visible to it
+    ASSERT_TRUE(store->put("apple2", "late"));
+    it->seek("apple");
+    it->next();
+    EXPECT_EQ(it->key(), "avocado");
+}
+
+TEST_F(KVStoreTest, SnapshotSeesPointInTimeState) {
+    ASSERT_TRUE(store->put("a", "1"));
+    ASSERT_TRUE(store->put("b", "1"));
+    auto snapshot = store->create_snapshot();
+    ASSERT_NE(snapshot, nullptr);
+
+    ASSERT_TRUE(store->put("a", "2"));
+    ASSERT_TRUE(store->remove("b"));
+    ASSERT_TRUE(store->put("c", "2"));
+
+    ReadOptions at_snapshot;
+    at_snapshot.snapshot = snapshot;
+    auto check = [&] {
+        std::string value;
+        EXPECT_TRUE(store->get("a", value, at_snapshot));
+        EXPECT_EQ(value, "1");
+        EXPECT_TRUE(store->get("b", value, at_snapshot));
+        EXPECT_FALSE(store->get("c", value, at_snapshot));
+        EXPECT_TRUE(store->get("a", value));
+        EXPECT_EQ(value, "2");
+        EXPECT_FALSE(store->get("b", value));
+
+        std::vector<std::string> keys;
+        auto it = store->new_iterator(at_snapshot);
+        for (it->seek_to_last(); it->valid(); it->prev()) {
+            keys.emplace_back(std::string(it->key()) + "=" + std::string(it->value()));
+        }
+        EXPECT_EQ(keys, (std::vector<std::string>{"b=1", "a=1"}));
+    };
+
+    // Same answers from the memtable, after a flush, and after compaction
+    // had the chance to merge the versions
+    check();
+    store->flush_memtable();
+    check();
+    store->compact();
+    check();
+
+    // Once released, compaction is free to drop the old versions
+    snapshot.reset();
+    at_snapshot.snapshot.reset();
+    ASSERT_TRUE(store->put("a", "3"));
+    store->compact();
+    auto it = store->new_iterator();
+    std::vector<std::string> keys;
+    for (it->seek_to_first(); it->valid(); it->next()) {
+        keys.emplace_back(it->key());
+    }
+    EXPECT_EQ(keys, (std::vector<std::string>{"a", "c"}));
+}
+
+TEST_F(KVStoreTest, SequencesSurviveReopen) {
+    ASSERT_TRUE(store->put("k", "flushed"));
+    store->flush_memtable();
+    ASSERT_TRUE(store->put("k", "logged"));
+    store.reset();
+
+    // Versions recovered from the tables and the log must keep their order,
+    // and new writes must still sort after them
+    store = std::make_unique<KVStore>(test_dir);
+    std::string value;
+    ASSERT_TRUE(store->get("k", value));
+    EXPECT_EQ(value, "logged");
+    ASSERT_TRUE(store->put("k", "new"));
+    store->flush_memtable();
+    store->compact();
+    ASSERT_TRUE(store->get("k", value));
+    EXPECT_EQ(value, "new");
+}
+
+TEST_F(KVStoreTest, RecoversEverySegmentInOrder) {
+    store.reset();
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directories(test_dir);
+
+    // Two segments left behind by a crash: an older memtable's and the
+    // active one's, which rewrites a key of the first
+    {
+        WAL older(test_dir + "/wal_3.log", 0);
+        ASSERT_TRUE(older.write_put("a", "old"));
+        ASSERT_TRUE(older.write_put("b", "kept"));
+        WAL newer(test_dir + "/wal_4.log", 2);
+        ASSERT_TRUE(newer.write_put("a", "new"));
+        ASSERT_TRUE(newer.write_delete("b"));
+        ASSERT_TRUE(newer.write_put("c", "added"));
+    }
+
+    store = std::make_unique<KVStore>(test_dir);
+    EXPECT_EQ(store->num_tables_at_level(0), 2u);
+    std::string value;
+    ASSERT_TRUE(store->get("a", value));
+    EXPECT_EQ(value, "new");
+    EXPECT_FALSE(store->get("b", value));
+    ASSERT_TRUE(store->get("c", value));
+    EXPECT_EQ(value, "added");
+    EXPECT_FALSE(std::filesystem::exists(test_dir + "/wal_3.log"));
+
+    // Recovered sequences still order the new writes after them
+    ASSERT_TRUE(store->put("a", "newest"));
+    store->compact();
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+    ASSERT_TRUE(store->get("a", value));
+    EXPECT_EQ(value, "newest");
+    EXPECT_FALSE(store->get("b", value));
+}
+
+TEST_F(KVStoreTest, OpensOnlyTablesInTheManifest) {
+    auto find_table = [&] {
+        for (const auto& entry : std::filesystem::directory_iterator(test_dir)) {
+            if (entry.path().extension() == ".sst") return entry.path();
+        }
+        return std::filesystem::path();
+    };
+
+    ASSERT_TRUE(store->put("a", "stale"));
+    store->flush_memtable();
+    std::string stale_table = test_dir + "/stale.bak";
+    std::filesystem::copy_file(find_table(), stale_table);
+    ASSERT_TRUE(store->put("a", "fresh"));
+    store->flush_memtable();
+    store->compact();
+    size_t tables = store->num_tables_at_level(Options().num_levels - 1);
+    store.reset();
+
+    // A valid table the manifest doesn't list, numbered to look newest
+    std::filesystem::rename(stale_table, test_dir + "/sstable_999.sst");
+    store = std::make_unique<KVStore>(test_dir);
+    std::string value;
+    ASSERT_TRUE(store->get("a", value));
+    EXPECT_EQ(value, "fresh");
+    EXPECT_EQ(store->num_tables_at_level(0), 0u);
+    EXPECT_EQ(store->num_tables_at_level(Options().num_levels - 1), tables);
+    EXPECT_FALSE(std::filesystem::exists(test_dir + "/sstable_999.sst"));
+
+    // New tables never take the stray file's number
+    ASSERT_TRUE(store->put("b", "1"));
+    store->flush_memtable();
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+    ASSERT_TRUE(store->get("b", value));
+    EXPECT_FALSE(std::filesystem::exists(test_dir + "/sstable_999.sst"));
+}
+
+TEST_F(KVStoreTest, KeepsTablesItCantOpen) {
+    ASSERT_TRUE(store->put("a", "1"));
+    store->flush_memtable();
+    std::filesystem::path table;
+    for (const auto& entry : std::filesystem::directory_iterator(test_dir)) {
+        if (entry.path().extension() == ".sst") table = entry.path();
+    }
+    // The newest segment is numbered past anything the manifest recorded
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+    ASSERT_TRUE(store->put("c", "3"));
+    store.reset();
+    auto logs = [&] {
+        std::map<std::string, std::string> contents;
+        for (const auto& entry : std::filesystem::directory_iterator(test_dir)) {
+            std::string name = entry.path().filename().string();
+            if (name.rfind("wal_", 0) == 0) {
+                std::ifstream in(entry.path(), std::ios::binary);
+                contents[name].assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+        }
+        return contents;
+    };
+    auto before = logs();
+
+    // Open without the table: nothing may be written, dropped or deleted,
+    // and no segment is reused for the new log
+    std::filesystem::rename(table, test_dir + "/aside");
+    store = std::make_unique<KVStore>(test_dir);
+    std::string value;
+    EXPECT_FALSE(store->get("a", value));
+    EXPECT_FALSE(store->put("b", "2"));
+    store.reset();
+    auto after = logs();
+    EXPECT_EQ(after.size(), before.size() + 1);
+    for (const auto& [name, contents] : before) {
+        ASSERT_TRUE(after.count(name)) << name;
+        EXPECT_EQ(after[name], contents) << name;
+    }
+
+    std::filesystem::rename(test_dir + "/aside", table);
+    store = std::make_unique<KVStore>(test_dir);
+    ASSERT_TRUE(store->get("a", value));
+    EXPECT_EQ(value, "1");
+    ASSERT_TRUE(store->get("c", value));
+    EXPECT_EQ(value, "3");
+    EXPECT_TRUE(store->put("b", "2"));
+}
+
+TEST_F(KVStoreTest, OpensTablesInParallel) {
+    store.reset();
+    std::filesystem::remove_all(test_dir);
+    Options options;
+    options.target_file_size = 4096;  // many tables below L0
+    options.l0_compaction_trigger = 100;  // and L0 left as flushed
+    options.l0_stop_writes_trigger = 200;
+    store = std::make_unique<KVStore>(test_dir, options);
+
+    auto key = [](int i) {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "key%04d", i);
+        return std::string(buf);
+    };
+    const std::string payload(100, 'v');
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_TRUE(store->put(key(i), payload + std::to_string(i)));
+    }
+    store->compact();
+
+    // Overlapping L0 tables, each overwriting "hot"; only the newest counts
+    for (int round = 0; round < 6; ++round) {
+        ASSERT_TRUE(store->put("hot", "round" + std::to_string(round)));
+        for (int i = round; i < 2000; i += 50) {
+            ASSERT_TRUE(store->put(key(i), "round" + std::to_string(round)));
+        }
+        store->flush_memtable();
+    }
+    std::vector<size_t> counts;
+    size_t deeper = 0;
+    for (int level = 0; level < options.num_levels; ++level) {
+        counts.push_back(store->num_tables_at_level(level));
+        deeper += level > 0 ? counts.back() : 0;
+    }
+    ASSERT_EQ(counts[0], 6u);
+    ASSERT_GT(deeper, 10u);
+
+    auto check = [&](const std::string& path, int threads) {
+        SCOPED_TRACE(path + ", " + std::to_string(threads) + " threads");
+        for (int level = 0; level < options.num_levels; ++level) {
+            EXPECT_EQ(store->num_tables_at_level(level), counts[level]) << level;
+        }
+        std::string value;
+        ASSERT_TRUE(store->get("hot", value));
+        EXPECT_EQ(value, "round5");
+        for (int i = 0; i < 2000; i += 7) {
+            ASSERT_TRUE(store->get(key(i), value)) << i;
+            EXPECT_EQ(value, i % 50 < 6 ? "round" + std::to_string(i % 50) : payload + std::to_string(i));
+        }
+    };
+    for (bool legacy : {false, true}) {
+        for (int threads : {1, 4}) {
+            store.reset();
+            if (legacy) {
+                // Opening writes a new manifest, so remove it every time
+                std::filesystem::remove(test_dir + "/MANIFEST");
+            }
+            options.max_open_threads = threads;
+            store = std::make_unique<KVStore>(test_dir, options);
+            check(legacy ? "directory scan" : "manifest", threads);
+        }
+    }
+}
+
+TEST_F(KVStoreTest, MultiGetMatchesGet) {
+    store.reset();
+    std::filesystem::remove_all(test_dir);
+    Options options;
+    options.target_file_size = 4096;  // several tables per level
+    store = std::make_unique<KVStore>(test_dir, options);
+
+    // Versions spread over L1, L0 and the memtable
+    auto key = [](int i) {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "key%04d", i);
+        return std::string(buf);
+    };
+    for (int i = 0; i < 2000; i += 2) {
+        ASSERT_TRUE(store->put(key(i), "base" + std::to_string(i)));
+    }
+    store->compact();
+    ASSERT_GT(store->num_tables_at_level(1), 1u);
+    for (int i = 0; i < 2000; i += 10) {
+        ASSERT_TRUE(store->put(key(i), "flushed" + std::to_string(i)));
+        ASSERT_TRUE(store->remove(key(i + 4)));
+    }
+    store->flush_memtable();
+    auto snapshot = store->create_snapshot();
+    for (int i = 0; i < 2000; i += 30) {
+        ASSERT_TRUE(store->put(key(i), "live" + std::to_string(i)));
+        ASSERT_TRUE(store->remove(key(i + 2)));
+    }
+
+    // Unsorted, with misses and a repeated key
+    std::vector<std::string> keys;
+    for (int i = 1999; i >= 0; i -= 7) {
+        keys.push_back(key(i));
+    }
+    keys.push_back(key(30));
+    keys.push_back("zzz");
+    ReadOptions at_snapshot;
+    at_snapshot.snapshot = snapshot;
+    for (const auto& read : {ReadOptions(), at_snapshot}) {
+        auto found = store->multi_get(keys, read);
+        ASSERT_EQ(found.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            std::string value;
+            bool expected = store->get(keys[i], value, read);
+            ASSERT_EQ(found[i].has_value(), expected) << keys[i];
+            if (expected) {
+                EXPECT_EQ(*found[i], value) << keys[i];
+            }
+        }
+    }
+    auto found = store->multi_get({key(30), key(32), key(34)});
+    EXPECT_EQ(found[0], "live30");
+    EXPECT_FALSE(found[1].has_value());
+    EXPECT_FALSE(found[2].has_value());
+}
+
+TEST_F(KVStoreTest, FailedReplayKeepsTheLog) {
+    store.reset();
+    for (const auto& entry : std::filesystem::directory_iterator(test_dir)) {
+        if (entry.path().filename().string().rfind("wal_", 0) == 0) {
+            std::filesystem::remove(entry.path());
+        }
+    }
+    {
+        WAL log(test_dir + "/wal_3.log", 0);
+        ASSERT_TRUE(log.write_put("a", "logged"));
+    }
+
+    // The table the segment replays into can't be created
+    std::filesystem::create_directory(test_dir + "/sstable_4.sst");
+    store = std::make_unique<KVStore>(test_dir);
+    EXPECT_FALSE(store->put("b", "refused"));
+    EXPECT_TRUE(std::filesystem::exists(test_dir + "/wal_3.log"));
+
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+    std::string value;
+    ASSERT_TRUE(store->get("a", value));
+    EXPECT_EQ(value, "logged");
+    EXPECT_FALSE(store->get("b", value));
+    EXPECT_TRUE(store->put("b", "accepted"));
+}
+
+TEST_F(KVStoreTest, ReusesFlushedLogSegments) {
+    auto count_files = [&](const std::string& suffix) {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(test_dir)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() > suffix.size() &&
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                count++;
+            }
+        }
+        return count;
+    };
+
+    // Every flush retires a segment, and every switch takes one back
+    for (int round = 0; round < 10; ++round) {
+        ASSERT_TRUE(store->put("key" + std::to_string(round), "value"));
+        store->flush_memtable();
+        EXPECT_EQ(count_files(".log"), 1u);
+        EXPECT_LE(count_files(".recycle"), 1u);
+    }
+
+    ASSERT_TRUE(store->put("unflushed", "value"));
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir);
+    std::string value;
+    for (int round = 0; round < 10; ++round) {
+        EXPECT_TRUE(store->get("key" + std::to_string(round), value));
+    }
+    ASSERT_TRUE(store->get("unflushed", value));
+    EXPECT_EQ(value, "value");
+}
+
+TEST_F(KVStoreTest, LargeValuesLiveInBlobFiles) {
+    auto count_blob_files = [&] {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(test_dir)) {
+            count += entry.path().extension() == ".blob";
+        }
+        return count;
+    };
+    auto large_value = [](int i) { return std::string(4096 + i, static_cast<char>('a' + i % 26)); };
+
+    Options options;
+    options.min_blob_size = 1024;
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir, options);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(store->put("big" + std::to_string(i), large_value(i)));
+        ASSERT_TRUE(store->put("small" + std::to_string(i), "tiny"));
+    }
+    store->flush_memtable();
+    EXPECT_EQ(count_blob_files(), 1u);
+
+    // Overwrite most of the large values so the first blob file is mostly
+    // garbage once compaction drops the old versions
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_TRUE(store->put("big" + std::to_string(i), large_value(i + 1)));
+    }
+    ASSERT_TRUE(store->remove("big9"));
+    store->compact();
+    EXPECT_EQ(store->get_stats().ticker(Ticker::BLOB_GC_COUNT), 1u);
+    EXPECT_EQ(count_blob_files(), 2u);
+
+    auto check = [&] {
+        std::string value;
+        for (int i = 0; i < 10; ++i) {
+            std::string key = "big" + std::to_string(i);
+            if (i == 9) {
+                EXPECT_FALSE(store->get(key, value));
+                continue;
+            }
+            ASSERT_TRUE(store->get(key, value)) << key;
+            EXPECT_TRUE(value == large_value(i < 8 ? i + 1 : i)) << key;
+            ASSERT_TRUE(store->get("small" + std::to_string(i), value));
+            EXPECT_EQ(value, "tiny");
+        }
+
+        // Scans read blob values in both directions
+        auto it = store->new_iterator();
+        it->seek("big8");
+        ASSERT_TRUE(it->valid());
+        EXPECT_TRUE(it->value() == large_value(8));
+        it->prev();
+        ASSERT_TRUE(it->valid());
+        EXPECT_EQ(it->key(), "big7");
+        EXPECT_TRUE(it->value() == large_value(8));
+        it->next();
+        it->next();
+        ASSERT_TRUE(it->valid());
+        EXPECT_EQ(it->key(), "small0");
+    };
+    check();
+
+    store.reset();
+    store = std::make_unique<KVStore>(test_dir, options);
+    check();
+    EXPECT_EQ(count_blob_files(), 2u);
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include "lsm.hpp"
+#include <filesystem>
+#include <fstream>
+
+class ManifestTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file = "./test_MANIFEST";
+        std::filesystem::remove(test_file);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(test_file);
+    }
+
+    static FileMetaData table(uint64_t number, int level, const std::string& smallest,
+                              const std::string& largest) {
+        FileMetaData file;
+        file.number = number;
+        file.level = level;
+        file.file_size = number * 100;
+        file.smallest_key = smallest;
+        file.largest_key = largest;
+        file.largest_sequence = number * 10;
+        return file;
+    }
+
+    std::string test_file;
+};
+
+TEST_F(ManifestTest, ReplaysEdits) {
+    {
+        Manifest manifest(test_file);
+        EXPECT_FALSE(manifest.recover());
+
+        VersionEdit edit;
+        edit.added = {table(3, 0, "a", "m"), table(4, 0, "c", "z")};
+        edit.next_file_number = 4;
+        ASSERT_TRUE(manifest.reset(edit));
+
+        // A compaction of both into level 1
+        edit = VersionEdit();
+        edit.removed = {3, 4};
+        edit.added = {table(6, 1, "a", "k"), table(7, 1, "l", "z")};
+        edit.next_file_number = 7;
+        ASSERT_TRUE(manifest.log_and_apply(edit));
+    }
+
+    Manifest manifest(test_file);
+    ASSERT_TRUE(manifest.recover());
+    EXPECT_EQ(manifest.next_file_number(), 7u);
+    ASSERT_EQ(manifest.files().size(), 2u);
+    const FileMetaData& file = manifest.files().at(7);
+    EXPECT_EQ(file.level, 1);
+    EXPECT_EQ(file.file_size, 700u);
+    EXPECT_EQ(file.smallest_key, "l");
+    EXPECT_EQ(file.largest_key, "z");
+    EXPECT_EQ(file.largest_sequence, 70u);
+    EXPECT_EQ(manifest.files().count(6), 1u);
+}
+
+TEST_F(ManifestTest, IgnoresTornLastRecord) {
+    {
+        Manifest manifest(test_file);
+        VersionEdit edit;
+        edit.added = {table(1, 0, "a", "b")};
+        ASSERT_TRUE(manifest.reset(edit));
+        edit.added = {table(2, 0, "c", "d")};
+        ASSERT_TRUE(manifest.log_and_apply(edit));
+    }
+    std::filesystem::resize_file(test_file, std::filesystem::file_size(test_file) - 3);
+
+    Manifest manifest(test_file);
+    ASSERT_TRUE(manifest.recover());
+    ASSERT_EQ(manifest.files().size(), 1u);
+    EXPECT_EQ(manifest.files().count(1), 1u);
+
+    // Reopening starts a new log without the torn record
+    VersionEdit edit;
+    edit.added = {table(5, 0, "e", "f")};
+    ASSERT_TRUE(manifest.log_and_apply(edit));
+    Manifest reopened(test_file);
+    ASSERT_TRUE(reopened.recover());
+    EXPECT_EQ(reopened.files().size(), 2u);
+    EXPECT_EQ(reopened.files().count(5), 1u);
+}
+
+TEST_F(ManifestTest, FailedEditIsNotApplied) {
+    Manifest manifest("./no_such_dir/MANIFEST");
+    VersionEdit edit;
+    edit.added = {table(1, 0, "a", "b")};
+    edit.next_file_number = 1;
+    EXPECT_FALSE(manifest.log_and_apply(edit));
+    EXPECT_TRUE(manifest.files().empty());
+    EXPECT_EQ(manifest.next_file_number(), 0u);
+}
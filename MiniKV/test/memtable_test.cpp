@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include "memtable.hpp"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(MemTableTest, PutGetOverwriteAndDelete) {
+    MemTable mem;
+    EXPECT_TRUE(mem.empty());
+
+    mem.put("b", "1");
+    mem.put("a", "2");
+    mem.put("b", "3");
+    mem.remove("c");
+
+    std::string value;
+    EXPECT_EQ(mem.get("a", value), LookupResult::FOUND);
+    EXPECT_EQ(value, "2");
+    EXPECT_EQ(mem.get("b", value), LookupResult::FOUND);
+    EXPECT_EQ(value, "3");
+    EXPECT_EQ(mem.get("c", value), LookupResult::DELETED);
+    EXPECT_EQ(mem.get("d", value), LookupResult::NOT_FOUND);
+    EXPECT_FALSE(mem.empty());
+}
+
+TEST(MemTableTest, KeepsVersionsBySequence) {
+    MemTable mem;
+    mem.put("k", "v1", 1);
+    mem.put("k", "v3", 3);
+    mem.remove("k", 5);
+    mem.put("j", "x", 4);
+
+    std::string value;
+    EXPECT_EQ(mem.get("k", value, 0), LookupResult::NOT_FOUND);
+    EXPECT_EQ(mem.get("k", value, 2), LookupResult::FOUND);
+    EXPECT_EQ(value, "v1");
+    EXPECT_EQ(mem.get("k", value, 4), LookupResult::FOUND);
+    EXPECT_EQ(value, "v3");
+    EXPECT_EQ(mem.get("k", value), LookupResult::DELETED);
+
+    // Versions of a key iterate newest first
+    std::vector<uint64_t> sequences;
+    MemTable::Iterator it(&mem);
+    for (it.seek("k"); it.valid(); it.next()) {
+        sequences.push_back(it.sequence());
+    }
+    EXPECT_EQ(sequences, (std::vector<uint64_t>{5, 3, 1}));
+    it.seek_to_last();
+    it.prev();
+    EXPECT_EQ(it.sequence(), 3u);
+}
+
+TEST(MemTableTest, SizeCountsArenaBytes) {
+    MemTable mem(4096);
+    size_t initial = mem.approximate_size();
+    EXPECT_LE(initial, 4096u + 64);
+
+    // Overwritten values stay in the arena until the memtable is dropped,
+    // so they keep counting towards the flush threshold
+    const std::string value(100, 'x');
+    for (int i = 0; i < 100; ++i) {
+        mem.put("key", value);
+    }
+    EXPECT_GE(mem.approximate_size(), 100u * value.size());
+    EXPECT_LT(mem.approximate_size(), 4u * 100 * value.size());
+}
+
+TEST(MemTableTest, ArenaAlignsAndSeparatesLargeAllocations) {
+    Arena arena(1024);
+    EXPECT_EQ(arena.memory_usage(), 0u);
+
+    for (size_t n = 1; n < 200; n += 7) {
+        char* p = arena.allocate(n);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % alignof(void*), 0u);
+    }
+    size_t before = arena.memory_usage();
+
+    // A large allocation gets its own block instead of wasting the current one
+    char* big = arena.allocate(10000);
+    EXPECT_GE(arena.memory_usage(), before + 10000);
+    char* small = arena.allocate(8);
+    EXPECT_NE(small, nullptr);
+    EXPECT_TRUE(small < big || small >= big + 10000);
+}
+
+TEST(MemTableTest, IteratesInKeyOrder) {
+    MemTable mem;
+    std::map<std::string, std::string> model;
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = "key" + std::to_string((i * 7919) % 1000);
+        mem.put(key, std::to_string(i));
+        model[key] = std::to_string(i);
+    }
+
+    MemTable::Iterator it(&mem);
+    auto expected = model.begin();
+    for (it.seek_to_first(); it.valid(); it.next(), ++expected) {
+        ASSERT_NE(expected, model.end());
+        EXPECT_EQ(it.key(), expected->first);
+        EXPECT_EQ(it.value(), expected->second);
+    }
+    EXPECT_EQ(expected, model.end());
+
+    auto rexpected = model.rbegin();
+    for (it.seek_to_last(); it.valid(); it.prev(), ++rexpected) {
+        EXPECT_EQ(it.key(), rexpected->first);
+    }
+    EXPECT_EQ(rexpected, model.rend());
+
+    it.seek("key5000");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key501");
+}
+
+TEST(MemTableTest, ConcurrentWritersAndReaders) {
+    MemTable mem;
+    const int kThreads = 4;
+    const int kPerThread = 5000;
+    std::atomic<bool> done{false};
+
+    // Readers run lock-free against the writers and must only ever see
+    // complete values
+    std::thread reader([&] {
+        std::string value;
+        while (!done.load()) {
+            for (int i = 0; i < kPerThread; i += 97) {
+                std::string key = "t0_" + std::to_string(i);
+                if (mem.get(key, value) == LookupResult::FOUND) {
+                    ASSERT_EQ(value, "v" + key);
+                }
+            }
+        }
+    });
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < kThreads; ++t) {
+        writers.emplace_back([&, t] {
+            for (int i = 0; i < kPerThread; ++i) {
+                std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                mem.put(key, "v" + key);
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    done = true;
+    reader.join();
+
+    std::string value;
+    int count = 0;
+    MemTable::Iterator it(&mem);
+    std::string last;
+    for (it.seek_to_first(); it.valid(); it.next(), ++count) {
+        EXPECT_LT(last, it.key());
+        last = std::string(it.key());
+    }
+    EXPECT_EQ(count, kThreads * kPerThread);
+    for (int t = 0; t < kThreads; ++t) {
+        std::string key = "t" + std::to_string(t) + "_" + std::to_string(kPerThread - 1);
+        ASSERT_EQ(mem.get(key, value), LookupResult::FOUND);
+        EXPECT_EQ(value, "v" + key);
+    }
+}
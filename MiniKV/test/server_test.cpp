@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+#include "server.hpp"
+#include "resp.hpp"
+#include "sharded_kvstore.hpp"
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+std::string command(const std::vector<std::string>& args) {
+    std::string out;
+    resp::append_array(out, args.size());
+    for (const auto& arg : args) {
+        resp::append_bulk(out, arg);
+    }
+    return out;
+}
+
+// Parses one reply at pos; false until all of it has arrived
+bool parse_reply(const std::string& buf, size_t& pos, std::vector<std::string>& out) {
+    size_t end = buf.find("\r\n", pos);
+    if (end == std::string::npos) return false;
+    char type = buf[pos];
+    std::string line = buf.substr(pos + 1, end - pos - 1);
+    pos = end + 2;
+    if (type == '*') {
+        for (long i = std::stol(line); i > 0; --i) {
+            if (!parse_reply(buf, pos, out)) return false;
+        }
+    } else if (type == '$' && std::stol(line) >= 0) {
+        size_t len = std::stoul(line);
+        if (buf.size() < pos + len + 2) return false;
+        out.push_back(buf.substr(pos, len));
+        pos += len + 2;
+    } else {
+        out.push_back(line);
+    }
+    return true;
+}
+
+// Minimal blocking client: sends everything, then reads until the reply
+// stream holds `expected` bytes
+class Client {
+public:
+    explicit Client(uint16_t port) {
+        fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        connected_ = ::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    }
+    ~Client() { ::close(fd_); }
+
+    bool connected() const { return connected_; }
+
+    std::string round_trip(const std::string& request, size_t expected) {
+        EXPECT_EQ(::send(fd_, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+        std::string reply;
+        char buffer[4096];
+        while (reply.size() < expected) {
+            ssize_t n = ::recv(fd_, buffer, sizeof(buffer), 0);
+            if (n <= 0) break;
+            reply.append(buffer, n);
+        }
+        return reply;
+    }
+
+    // Sends a command and returns its reply with arrays flattened
+    std::vector<std::string> call(const std::string& request) {
+        EXPECT_EQ(::send(fd_, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+        std::string reply;
+        std::vector<std::string> values;
+        size_t pos = 0;
+        char buffer[4096];
+        while (values.clear(), pos = 0, !parse_reply(reply, pos, values)) {
+            ssize_t n = ::recv(fd_, buffer, sizeof(buffer), 0);
+            if (n <= 0) return {};
+            reply.append(buffer, n);
+        }
+        return values;
+    }
+
+private:
+    int fd_;
+    bool connected_;
+};
+
+}
+
+TEST(RespTest, ParsesArraysAndInlineCommands) {
+    std::vector<std::string> args;
+    size_t consumed = 0;
+    std::string wire = command({"SET", "key", std::string("a\r\nb", 4)}) + "GET key\r\n";
+
+    // Every strict prefix of the first command is incomplete
+    size_t first = command({"SET", "key", std::string("a\r\nb", 4)}).size();
+    for (size_t n = 0; n < first; ++n) {
+        EXPECT_EQ(resp::parse_command(std::string_view(wire).substr(0, n), consumed, args),
+                  resp::ParseResult::INCOMPLETE) << n;
+    }
+    ASSERT_EQ(resp::parse_command(wire, consumed, args), resp::ParseResult::OK);
+    EXPECT_EQ(consumed, first);
+    EXPECT_EQ(args, (std::vector<std::string>{"SET", "key", std::string("a\r\nb", 4)}));
+
+    ASSERT_EQ(resp::parse_command(std::string_view(wire).substr(consumed), consumed, args),
+              resp::ParseResult::OK);
+    EXPECT_EQ(args, (std::vector<std::string>{"GET", "key"}));
+
+    EXPECT_EQ(resp::parse_command("*1\r\n$3\r\nGETX\r\n", consumed, args), resp::ParseResult::ERROR);
+    EXPECT_EQ(resp::parse_command("*x\r\n", consumed, args), resp::ParseResult::ERROR);
+}
+
+TEST(ServerTest, ServesPipelinedCommands) {
+    const std::string dir = "./test_server_data";
+    std::filesystem::remove_all(dir);
+    {
+        ShardedKVStore store(dir, 2);
+        ServerOptions options;
+        options.port = 0;
+        options.num_workers = 2;
+        Server server(store, options);
+        ASSERT_TRUE(server.start());
+
+        Client client(server.port());
+        ASSERT_TRUE(client.connected());
+
+        // One pipeline: a run of writes, then reads that must see them
+        std::string request = command({"SET", "a", "1"}) + command({"SET", "b", "2"}) +
+                              command({"SET", "c", "3"}) + command({"DEL", "b", "b", "zz"}) +
+                              command({"GET", "a"}) + command({"MGET", "a", "b", "c"}) +
+                              command({"PING"}) + command({"NOPE"});
+        std::string expected = "+OK\r\n+OK\r\n+OK\r\n:1\r\n$1\r\n1\r\n"
+                               "*3\r\n$1\r\n1\r\n$-1\r\n$1\r\n3\r\n+PONG\r\n"
+                               "-ERR unknown command 'NOPE'\r\n";
+        EXPECT_EQ(client.round_trip(request, expected.size()), expected);
+
+        // SCAN walks every key across shards, in order, via the cursor
+        for (int i = 0; i < 25; ++i) {
+            ASSERT_TRUE(store.put("scan:" + std::to_string(100 + i), "x"));
+        }
+        std::string cursor = "0";
+        std::vector<std::string> keys;
+        do {
+            auto reply = client.call(command({"SCAN", cursor, "MATCH", "scan:*", "COUNT", "10"}));
+            ASSERT_FALSE(reply.empty());
+            cursor = reply[0];
+            keys.insert(keys.end(), reply.begin() + 1, reply.end());
+        } while (cursor != "0");
+        ASSERT_EQ(keys.size(), 25u);
+        EXPECT_EQ(keys.front(), "scan:100");
+        EXPECT_EQ(keys.back(), "scan:124");
+
+        std::string quit = "+OK\r\n";
+        EXPECT_EQ(client.round_trip(command({"QUIT"}), quit.size()), quit);
+        server.stop();
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST(ServerTest, RefusesCommandsOverTheInputLimit) {
+    const std::string dir = "./test_server_data";
+    std::filesystem::remove_all(dir);
+    {
+        ShardedKVStore store(dir, 2);
+        ServerOptions options;
+        options.port = 0;
+        options.num_workers = 2;
+        Server server(store, options);
+        ASSERT_TRUE(server.start());
+
+        // Each argument is within the bulk limit, the command is not; the
+        // commands before it are still answered
+        Client client(server.port());
+        ASSERT_TRUE(client.connected());
+        std::string part(22 * 1024 * 1024, 'x');
+        std::string request = command({"PING"}) + command({"SET", part, part, part});
+        std::string expected = "+PONG\r\n-ERR command too large\r\n";
+        EXPECT_EQ(client.round_trip(request, expected.size()), expected);
+
+        // A bulk length past the limit is refused from its header alone
+        Client other(server.port());
+        ASSERT_TRUE(other.connected());
+        expected = "-ERR Protocol error\r\n";
+        EXPECT_EQ(other.round_trip("*2\r\n$3\r\nGET\r\n$1000000000\r\n", expected.size()), expected);
+        server.stop();
+    }
+    std::filesystem::remove_all(dir);
+}
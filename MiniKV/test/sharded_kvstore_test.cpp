@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include "sharded_kvstore.hpp"
+#include "write_batch.hpp"
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <vector>
+
+class ShardedKVStoreTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_dir = "./test_sharded_data";
+        std::filesystem::remove_all(test_dir);
+        store = std::make_unique<ShardedKVStore>(test_dir, 4);
+    }
+
+    void TearDown() override {
+        store.reset();
+        std::filesystem::remove_all(test_dir);
+    }
+
+    std::string test_dir;
+    std::unique_ptr<ShardedKVStore> store;
+};
+
+TEST_F(ShardedKVStoreTest, SpreadsKeysAndKeepsShardCount) {
+    for (int i = 0; i < 200; ++i) {
+        ASSERT_TRUE(store->put("key" + std::to_string(i), "v" + std::to_string(i)));
+    }
+    ASSERT_TRUE(store->remove("key7"));
+    WriteBatch batch;
+    batch.put("key8", "batched");
+    batch.remove("key9");
+    ASSERT_TRUE(store->write(batch));
+
+    // Each shard keeps its own directory
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(std::filesystem::exists(test_dir + "/shard_" + std::to_string(i)));
+    }
+
+    // Reopening with another count must not move keys to other shards
+    store.reset();
+    store = std::make_unique<ShardedKVStore>(test_dir, 8);
+    EXPECT_EQ(store->num_shards(), 4u);
+    std::string value;
+    ASSERT_TRUE(store->get("key100", value));
+    EXPECT_EQ(value, "v100");
+    ASSERT_TRUE(store->get("key8", value));
+    EXPECT_EQ(value, "batched");
+    EXPECT_FALSE(store->get("key7", value));
+    EXPECT_FALSE(store->get("key9", value));
+
+    // Nor must losing SHARDS, while the shards are there to count
+    store.reset();
+    std::ofstream(test_dir + "/SHARDS", std::ios::trunc).close();
+    store = std::make_unique<ShardedKVStore>(test_dir, 8);
+    EXPECT_EQ(store->num_shards(), 4u);
+    ASSERT_TRUE(store->get("key100", value));
+    EXPECT_EQ(value, "v100");
+}
+
+TEST_F(ShardedKVStoreTest, ScansMergeShardsInOrder) {
+    std::map<std::string, std::string> model;
+    for (int i = 0; i < 300; ++i) {
+        std::string key = "k" + std::to_string(1000 + i);
+        ASSERT_TRUE(store->put(key, std::to_string(i)));
+        model[key] = std::to_string(i);
+    }
+    store->flush_memtable();
+
+    auto it = store->new_iterator();
+    auto expected = model.begin();
+    for (it->seek_to_first(); it->valid(); it->next(), ++expected) {
+        ASSERT_NE(expected, model.end());
+        EXPECT_EQ(it->key(), expected->first);
+        EXPECT_EQ(it->value(), expected->second);
+    }
+    EXPECT_EQ(expected, model.end());
+
+    // Turning around in the middle, then a prefix-limited scan backward
+    it->seek("k1150");
+    it->prev();
+    ASSERT_TRUE(it->valid());
+    EXPECT_EQ(it->key(), "k1149");
+    it->next();
+    EXPECT_EQ(it->key(), "k1150");
+
+    ReadOptions options;
+    options.prefix = "k12";
+    it = store->new_iterator(options);
+    std::vector<std::string> keys;
+    for (it->seek_to_last(); it->valid(); it->prev()) {
+        keys.emplace_back(it->key());
+    }
+    ASSERT_EQ(keys.size(), 100u);
+    EXPECT_EQ(keys.front(), "k1299");
+    EXPECT_EQ(keys.back(), "k1200");
+}
+
+TEST_F(ShardedKVStoreTest, ConcurrentWritersAcrossShards) {
+    const int kThreads = 8;
+    const int kPerThread = 200;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < kPerThread; ++i) {
+                std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                EXPECT_TRUE(store->put(key, key));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    int count = 0;
+    auto it = store->new_iterator();
+    for (it->seek_to_first(); it->valid(); it->next()) {
+        EXPECT_EQ(it->key(), it->value());
+        ++count;
+    }
+    EXPECT_EQ(count, kThreads * kPerThread);
+}
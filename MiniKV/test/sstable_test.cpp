@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 #include "sstable.hpp"
+#include "bloom.hpp"
+#include "compression.hpp"
 #include <filesystem>
 #include <map>
+#include <fstream>
 
 class SSTableTest : public ::testing::Test {
 protected:
@@ -41,3 +44,327 @@ TEST_F(SSTableTest, WriteAndRead) {
 
     EXPECT_FALSE(sstable_read.get("nonexistent", value));
 }
+
+TEST_F(SSTableTest, BloomFilterRejectsMostMisses) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; ++i) {
+        keys.push_back("key" + std::to_string(i));
+    }
+    std::string filter = BloomFilter::build(keys, 10);
+
+    for (const auto& key : keys) {
+        EXPECT_TRUE(BloomFilter::may_contain(filter, key));
+    }
+
+    int false_positives = 0;
+    for (int i = 0; i < 10000; ++i) {
+        if (BloomFilter::may_contain(filter, "missing" + std::to_string(i))) {
+            false_positives++;
+        }
+    }
+    EXPECT_LT(false_positives, 300);  // ~1% expected at 10 bits per key
+}
+
+TEST_F(SSTableTest, FilterIsPersisted) {
+    std::map<std::string, std::string> data;
+    for (int i = 0; i < 100; ++i) {
+        data["key" + std::to_string(i)] = "value" + std::to_string(i);
+    }
+
+    {
+        SSTable sstable(test_file);
+        EXPECT_TRUE(sstable.write(data));
+    }
+
+    SSTable sstable_read(test_file);
+    EXPECT_TRUE(sstable_read.may_contain("key42"));
+
+    int false_positives = 0;
+    for (int i = 0; i < 1000; ++i) {
+        if (sstable_read.may_contain("missing" + std::to_string(i))) {
+            false_positives++;
+        }
+    }
+    EXPECT_LT(false_positives, 50);
+
+    std::string value;
+    EXPECT_TRUE(sstable_read.get("key42", value));
+    EXPECT_EQ(value, "value42");
+}
+
+TEST_F(SSTableTest, ReadsTablesWithoutFooter) {
+    // Entries exactly as tables were written before filters were added
+    {
+        std::ofstream file(test_file, std::ios::binary);
+        for (const std::string key : {"a", "b"}) {
+            uint16_t len = 1;
+            file.write(reinterpret_cast<const char*>(&len), sizeof(len));
+            file.write(key.data(), len);
+            file.write(reinterpret_cast<const char*>(&len), sizeof(len));
+            file.write(key.data(), len);
+        }
+    }
+
+    SSTable sstable(test_file);
+    EXPECT_TRUE(sstable.is_valid());
+    std::string value;
+    EXPECT_TRUE(sstable.get("b", value));
+    EXPECT_EQ(value, "b");
+    EXPECT_FALSE(sstable.get("c", value));
+}
+
+TEST_F(SSTableTest, SpansManyBlocks) {
+    Options options;
+    options.block_size = 256;
+
+    std::map<std::string, std::string> data;
+    for (int i = 0; i < 2000; ++i) {
+        data["key" + std::to_string(100000 + i)] = "value" + std::to_string(i);
+    }
+
+    {
+        SSTable sstable(test_file, options);
+        EXPECT_TRUE(sstable.write(data));
+    }
+
+    SSTable sstable_read(test_file, options);
+    EXPECT_TRUE(sstable_read.is_valid());
+
+    std::string value;
+    for (const auto& [key, expected] : data) {
+        ASSERT_TRUE(sstable_read.get(key, value)) << key;
+        EXPECT_EQ(value, expected);
+    }
+    EXPECT_FALSE(sstable_read.get("key0", value));
+    EXPECT_FALSE(sstable_read.get("key100000x", value));
+    EXPECT_FALSE(sstable_read.get("key999999", value));
+}
+
+TEST_F(SSTableTest, StreamAndMappedReadsAgree) {
+    std::map<std::string, std::string> data;
+    for (int i = 0; i < 500; ++i) {
+        data["key" + std::to_string(i)] = std::string(i % 50, 'x');
+    }
+
+    {
+        SSTable sstable(test_file);
+        EXPECT_TRUE(sstable.write(data));
+    }
+
+    Options stream_options;
+    stream_options.use_mmap_reads = false;
+    SSTable mapped(test_file);
+    SSTable streamed(test_file, stream_options);
+
+    for (const auto& [key, expected] : data) {
+        std::string mapped_value, streamed_value;
+        ASSERT_TRUE(mapped.get(key, mapped_value));
+        ASSERT_TRUE(streamed.get(key, streamed_value));
+        EXPECT_EQ(mapped_value, expected);
+        EXPECT_EQ(streamed_value, expected);
+    }
+}
+
+TEST_F(SSTableTest, BlockCacheServesRepeatedReads) {
+    auto cache = std::make_shared<BlockCache>(1024 * 1024);
+    Options options;
+    options.use_mmap_reads = false;
+    options.block_cache = cache;
+
+    std::map<std::string, std::string> data = {{"key1", "value1"}, {"key2", "value2"}};
+    SSTable sstable(test_file, options);
+    EXPECT_TRUE(sstable.write(data));
+
+    std::string value;
+    EXPECT_TRUE(sstable.get("key1", value));
+    EXPECT_EQ(cache->misses(), 1u);
+    EXPECT_TRUE(sstable.get("key2", value));
+    EXPECT_EQ(value, "value2");
+    EXPECT_EQ(cache->hits(), 1u);
+    EXPECT_GT(cache->usage(), 0u);
+}
+
+TEST_F(SSTableTest, BlockCacheEvictsLeastRecentlyUsed) {
+    BlockCache cache(100, 1);
+    auto block = [](char c) { return std::make_shared<const std::string>(40, c); };
+
+    cache.insert(1, 0, block('a'));
+    cache.insert(1, 40, block('b'));
+    EXPECT_TRUE(cache.lookup(1, 0));  // 'a' becomes most recently used
+    cache.insert(1, 80, block('c'));  // over budget: evicts 'b'
+
+    EXPECT_TRUE(cache.lookup(1, 0));
+    EXPECT_FALSE(cache.lookup(1, 40));
+    EXPECT_TRUE(cache.lookup(1, 80));
+    EXPECT_LE(cache.usage(), 100u);
+}
+
+TEST_F(SSTableTest, IteratesEntriesAndKeepsMetadata) {
+    Options options;
+    options.block_size = 256;
+    {
+        SSTable sstable(test_file, options);
+        ASSERT_TRUE(sstable.begin_write(2));
+        for (int i = 100; i < 400; ++i) {
+            sstable.add("key" + std::to_string(i), "value" + std::to_string(i), i % 10 == 0);
+        }
+        ASSERT_TRUE(sstable.finish_write());
+    }
+
+    SSTable sstable(test_file, options);
+    ASSERT_TRUE(sstable.is_valid());
+    EXPECT_EQ(sstable.level(), 2);
+    EXPECT_EQ(sstable.smallest_key(), "key100");
+    EXPECT_EQ(sstable.largest_key(), "key399");
+
+    SSTable::Iterator it(&sstable);
+    int count = 0;
+    for (it.seek_to_first(); it.valid(); it.next(), ++count) {
+        int i = 100 + count;
+        EXPECT_EQ(it.key(), "key" + std::to_string(i));
+        EXPECT_EQ(it.deleted(), i % 10 == 0);
+        if (!it.deleted()) {
+            EXPECT_EQ(it.value(), "value" + std::to_string(i));
+        }
+    }
+    EXPECT_EQ(count, 300);
+
+    // Backward across block boundaries
+    count = 0;
+    for (it.seek_to_last(); it.valid(); it.prev(), ++count) {
+        EXPECT_EQ(it.key(), "key" + std::to_string(399 - count));
+    }
+    EXPECT_EQ(count, 300);
+
+    it.seek("key2505");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key251");
+
+    std::string value;
+    EXPECT_EQ(sstable.lookup("key200", value), LookupResult::DELETED);
+    EXPECT_EQ(sstable.lookup("key201", value), LookupResult::FOUND);
+}
+
+TEST_F(SSTableTest, PrefixCompressesKeysWithinBlocks) {
+    Options options;
+    options.block_size = 1024;
+    options.block_restart_interval = 4;
+    options.compression = kNoCompression;  // measure the key encoding alone
+    std::map<std::string, std::string> data;
+    for (int i = 0; i < 2000; ++i) {
+        data["tenant:1234:user:" + std::to_string(100000 + i)] = "v" + std::to_string(i);
+    }
+
+    // A restart at every entry stores every key whole
+    Options uncompressed = options;
+    uncompressed.block_restart_interval = 1;
+    uint64_t full_size;
+    {
+        SSTable sstable(test_file, uncompressed);
+        ASSERT_TRUE(sstable.write(data));
+        full_size = sstable.file_size();
+        SSTable compressed(test_file, options);
+        ASSERT_TRUE(compressed.write(data));
+    }
+
+    SSTable sstable(test_file, options);
+    ASSERT_TRUE(sstable.is_valid());
+    EXPECT_LT(sstable.file_size() * 3, full_size * 2);
+
+    std::string value;
+    for (const auto& [key, expected] : data) {
+        ASSERT_TRUE(sstable.get(key, value)) << key;
+        EXPECT_EQ(value, expected);
+    }
+    EXPECT_FALSE(sstable.get("tenant:1234:user:1000005", value));
+
+    // Seeks land between restart points, and walking back rebuilds keys
+    SSTable::Iterator it(&sstable);
+    it.seek("tenant:1234:user:1010005");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "tenant:1234:user:101001");
+    auto expected = data.rbegin();
+    for (it.seek_to_last(); it.valid(); it.prev(), ++expected) {
+        ASSERT_NE(expected, data.rend());
+        EXPECT_EQ(it.key(), expected->first);
+    }
+    EXPECT_EQ(expected, data.rend());
+}
+
+TEST_F(SSTableTest, CompressesBlocksThatShrink) {
+    LZCompressor lz;
+    std::string json, packed, unpacked;
+    for (int i = 0; i < 200; ++i) {
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"user\",\"active\":true}";
+    }
+    lz.compress(json, packed);
+    EXPECT_LT(packed.size() * 3, json.size());
+    ASSERT_TRUE(lz.decompress(packed, unpacked));
+    EXPECT_EQ(unpacked, json);
+    EXPECT_FALSE(lz.decompress(packed.substr(0, packed.size() / 2), unpacked));
+
+    // Compressible values shrink the file; random ones are stored as is.
+    // Both read back the same whether mapped or read through the cache.
+    std::map<std::string, std::string> data;
+    uint32_t state = 1;
+    for (int i = 0; i < 500; ++i) {
+        std::string noise(64, '\0');
+        for (char& c : noise) {
+            state = state * 1103515245 + 12345;
+            c = static_cast<char>(state >> 24);
+        }
+        data["json" + std::to_string(i)] = json.substr(i % 50, 300);
+        data["noise" + std::to_string(i)] = noise;
+    }
+    Options plain;
+    plain.compression = kNoCompression;
+    uint64_t plain_size;
+    {
+        SSTable sstable(test_file, plain);
+        ASSERT_TRUE(sstable.write(data));
+        plain_size = sstable.file_size();
+    }
+    Options compressed;
+    {
+        SSTable sstable(test_file, compressed);
+        ASSERT_TRUE(sstable.write(data));
+        EXPECT_LT(sstable.file_size() * 3, plain_size * 2);
+    }
+
+    Options streamed;
+    streamed.use_mmap_reads = false;
+    streamed.block_cache = std::make_shared<BlockCache>(1 << 20);
+    for (const Options& options : {compressed, streamed}) {
+        SSTable sstable(test_file, options);
+        ASSERT_TRUE(sstable.is_valid());
+        std::string value;
+        for (const auto& [key, expected] : data) {
+            ASSERT_TRUE(sstable.get(key, value)) << key;
+            EXPECT_EQ(value, expected);
+        }
+    }
+}
+
+TEST_F(SSTableTest, StoresEntriesPastSixteenBitLengths) {
+    std::map<std::string, std::string> data = {
+        {"a", "small"},
+        {"b" + std::string(70000, 'k'), "long key"},
+        {"c", std::string(2 * 1024 * 1024, 'v')},
+    };
+    {
+        SSTable sstable(test_file);
+        ASSERT_TRUE(sstable.write(data));
+    }
+
+    Options streamed;
+    streamed.use_mmap_reads = false;
+    for (const Options& options : {Options(), streamed}) {
+        SSTable sstable(test_file, options);
+        ASSERT_TRUE(sstable.is_valid());
+        for (const auto& [key, expected] : data) {
+            std::string value;
+            ASSERT_TRUE(sstable.get(key, value));
+            EXPECT_EQ(value, expected);
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "statistics.hpp"
+#include "kvstore.hpp"
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+TEST(StatisticsTest, CountsAcrossThreads) {
+    Statistics stats;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&stats] {
+            for (int i = 0; i < 1000; ++i) {
+                stats.record_tick(Ticker::GET_HIT);
+                stats.record_tick(Ticker::BYTES_READ, 10);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(stats.ticker(Ticker::GET_HIT), 8000u);
+    EXPECT_EQ(stats.ticker(Ticker::BYTES_READ), 80000u);
+    EXPECT_EQ(stats.ticker(Ticker::GET_MISS), 0u);
+
+    stats.reset();
+    EXPECT_EQ(stats.ticker(Ticker::GET_HIT), 0u);
+}
+
+TEST(StatisticsTest, HistogramPercentiles) {
+    Statistics stats;
+    EXPECT_EQ(stats.histogram(Histogram::GET).count, 0u);
+
+    // 1..10000 ns, uniformly
+    for (uint64_t v = 1; v <= 10000; ++v) {
+        stats.record_time(Histogram::GET, v);
+    }
+    HistogramData data = stats.histogram(Histogram::GET);
+    EXPECT_EQ(data.count, 10000u);
+    EXPECT_EQ(data.min, 1u);
+    EXPECT_EQ(data.max, 10000u);
+    EXPECT_DOUBLE_EQ(data.average(), 5000.5);
+
+    // Buckets are a quarter of a power of two wide
+    EXPECT_NEAR(data.p50, 5000, 5000 * 0.125);
+    EXPECT_NEAR(data.p99, 9900, 9900 * 0.125);
+    EXPECT_NEAR(data.p999, 9990, 9990 * 0.125);
+    EXPECT_LE(data.p50, data.p99);
+    EXPECT_LE(data.p99, data.p999);
+    EXPECT_LE(data.p999, data.max);
+
+    // Other histograms are untouched
+    EXPECT_EQ(stats.histogram(Histogram::PUT).count, 0u);
+}
+
+TEST(StatisticsTest, StoreRecordsOperations) {
+    std::string dir = "./test_data_stats";
+    std::filesystem::remove_all(dir);
+    {
+        KVStore store(dir);
+        ASSERT_TRUE(store.put("a", "1"));
+        ASSERT_TRUE(store.put("b", "22"));
+        ASSERT_TRUE(store.remove("a"));
+
+        std::string value;
+        EXPECT_TRUE(store.get("b", value));   // memtable hit
+        EXPECT_FALSE(store.get("a", value));  // tombstone in the memtable
+        store.flush_memtable();
+        EXPECT_TRUE(store.get("b", value));   // from the flushed table
+        EXPECT_FALSE(store.get("c", value));
+
+        StatsSnapshot stats = store.get_stats();
+        EXPECT_EQ(stats.histogram(Histogram::PUT).count, 2u);
+        EXPECT_EQ(stats.histogram(Histogram::REMOVE).count, 1u);
+        EXPECT_EQ(stats.histogram(Histogram::GET).count, 4u);
+        EXPECT_EQ(stats.histogram(Histogram::FLUSH).count, 1u);
+        EXPECT_EQ(stats.ticker(Ticker::GET_HIT), 2u);
+        EXPECT_EQ(stats.ticker(Ticker::GET_MISS), 2u);
+        EXPECT_EQ(stats.ticker(Ticker::MEMTABLE_HIT), 2u);
+        EXPECT_EQ(stats.ticker(Ticker::MEMTABLE_MISS), 2u);
+        EXPECT_EQ(stats.ticker(Ticker::SSTABLE_PROBES), 2u);
+        EXPECT_EQ(stats.ticker(Ticker::BYTES_WRITTEN), 1u + 1 + 1 + 2 + 1);
+        EXPECT_EQ(stats.ticker(Ticker::WAL_SYNCS), 3u);
+        EXPECT_GT(stats.ticker(Ticker::WAL_BYTES), 0u);
+        EXPECT_EQ(stats.ticker(Ticker::FLUSH_COUNT), 1u);
+        EXPECT_GT(stats.ticker(Ticker::FLUSH_BYTES), 0u);
+        EXPECT_NE(stats.to_string().find("memtable.hit"), std::string::npos);
+    }
+    std::filesystem::remove_all(dir);
+}
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 #include "wal.hpp"
+#include "write_batch.hpp"
 #include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <atomic>
 
 class WALTest : public ::testing::Test {
 protected:
@@ -48,3 +53,212 @@ TEST_F(WALTest, WriteAndReadDelete) {
     EXPECT_EQ(entries[0].key, "key1");
     EXPECT_TRUE(entries[0].value.empty());
 }
+
+TEST_F(WALTest, ConcurrentWritersAreGroupCommitted) {
+    const int num_threads = 8;
+    const int per_thread = 50;
+    std::atomic<int> applied{0};
+
+    {
+        WAL wal(test_file);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < per_thread; ++i) {
+                    std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                    EXPECT_TRUE(wal.write_put(key, "v", [&](uint64_t) { applied++; }));
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    EXPECT_EQ(applied.load(), num_threads * per_thread);
+
+    WAL wal_read(test_file);
+    auto entries = wal_read.read_all();
+    EXPECT_EQ(entries.size(), static_cast<size_t>(num_threads * per_thread));
+}
+
+TEST_F(WALTest, ClearInsideExclusiveSection) {
+    WAL wal(test_file);
+    EXPECT_TRUE(wal.write_put("key1", "value1"));
+    wal.run_exclusive([&] { wal.clear(); });
+    EXPECT_TRUE(wal.write_put("key2", "value2"));
+
+    auto entries = wal.read_all();
+    ASSERT_EQ(entries.size(), 1);
+    EXPECT_EQ(entries[0].key, "key2");
+}
+
+TEST_F(WALTest, WriteAndReadBatch) {
+    {
+        WAL wal(test_file);
+        WriteBatch batch;
+        batch.put("key1", "value1");
+        batch.remove("key2");
+        EXPECT_TRUE(wal.write_batch(batch));
+    }
+
+    WAL wal_read(test_file);
+    auto entries = wal_read.read_all();
+
+    ASSERT_EQ(entries.size(), 1);
+    EXPECT_EQ(entries[0].op_type, WAL::OpType::BATCH);
+    ASSERT_EQ(entries[0].batch.size(), 2);
+    EXPECT_EQ(entries[0].batch[0].key, "key1");
+    EXPECT_EQ(entries[0].batch[0].value, "value1");
+    EXPECT_EQ(entries[0].batch[1].op_type, WAL::OpType::DELETE);
+    EXPECT_EQ(entries[0].batch[1].key, "key2");
+}
+
+TEST_F(WALTest, TornBatchIsDropped) {
+    {
+        WAL wal(test_file);
+        EXPECT_TRUE(wal.write_put("key1", "value1"));
+        WriteBatch batch;
+        batch.put("key2", "value2");
+        batch.put("key3", "value3");
+        EXPECT_TRUE(wal.write_batch(batch));
+    }
+
+    // Simulate a crash in the middle of the batch frame
+    std::filesystem::resize_file(test_file, std::filesystem::file_size(test_file) - 3);
+
+    WAL wal_read(test_file);
+    auto entries = wal_read.read_all();
+    ASSERT_EQ(entries.size(), 1);
+    EXPECT_EQ(entries[0].key, "key1");
+}
+
+TEST_F(WALTest, ReplayStreamsRecordsInOrder) {
+    {
+        WAL wal(test_file, 10);
+        EXPECT_TRUE(wal.write_put("key1", "value1"));
+        WriteBatch batch;
+        batch.put("key2", "value2");
+        batch.remove("key3");
+        EXPECT_TRUE(wal.write_batch(batch));
+        EXPECT_TRUE(wal.write_delete("key4"));
+    }
+
+    std::vector<std::string> seen;
+    EXPECT_TRUE(WAL::replay_file(test_file, [&](const WAL::EntryView& entry) {
+        if (entry.op_type == WAL::OpType::BATCH) {
+            EXPECT_EQ(entry.sequence, 12u);
+            for (const auto& op : entry.batch) {
+                seen.push_back(std::string(op.key) + "=" + std::string(op.value));
+            }
+        } else {
+            seen.push_back(std::string(entry.key) + "=" + std::string(entry.value));
+        }
+        return true;
+    }));
+    EXPECT_EQ(seen, (std::vector<std::string>{"key1=value1", "key2=value2", "key3=", "key4="}));
+
+    // Returning false stops the replay
+    int calls = 0;
+    EXPECT_TRUE(WAL::replay_file(test_file, [&](const WAL::EntryView&) { return ++calls < 2; }));
+    EXPECT_EQ(calls, 2);
+
+    EXPECT_FALSE(WAL::replay_file("./missing_wal.log", [](const WAL::EntryView&) { return true; }));
+}
+
+TEST_F(WALTest, PreallocatedSegmentEndsAtLastRecord) {
+    {
+        WAL wal(test_file, 0, nullptr, 1 << 20);
+        EXPECT_TRUE(wal.write_put("key1", "value1"));
+        EXPECT_TRUE(wal.write_delete("key2"));
+    }
+#ifdef __linux__
+    EXPECT_GE(std::filesystem::file_size(test_file), 1u << 20);
+#endif
+
+    // Reopening appends after the last record, not after the reserved space
+    {
+        WAL wal(test_file, 2, nullptr, 1 << 20);
+        EXPECT_TRUE(wal.write_put("key3", "value3"));
+    }
+    auto entries = WAL::read_file(test_file);
+    ASSERT_EQ(entries.size(), 3);
+    EXPECT_EQ(entries[1].op_type, WAL::OpType::DELETE);
+    EXPECT_EQ(entries[2].key, "key3");
+    EXPECT_EQ(entries[2].sequence, 3u);
+}
+
+TEST_F(WALTest, RecycledSegmentForgetsOldRecords) {
+    std::string reused = "./test_wal_reused.log";
+    {
+        WAL wal(test_file);
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_TRUE(wal.write_put("old" + std::to_string(i), "value"));
+        }
+    }
+
+    {
+        WAL wal("./test_wal_first.log");
+        ASSERT_TRUE(wal.switch_file(reused, test_file));
+        EXPECT_TRUE(wal.write_put("new", "value"));
+    }
+    EXPECT_FALSE(std::filesystem::exists(test_file));
+
+    // The old records are still on disk past the new one, but not read back
+    auto entries = WAL::read_file(reused);
+    ASSERT_EQ(entries.size(), 1);
+    EXPECT_EQ(entries[0].key, "new");
+
+    std::filesystem::remove("./test_wal_first.log");
+    std::filesystem::remove(reused);
+}
+
+TEST_F(WALTest, LargeValuesRoundTrip) {
+    std::string key(70000, 'k');
+    std::string value(3 * 1024 * 1024, 'v');
+    {
+        WAL wal(test_file);
+        EXPECT_TRUE(wal.write_put(key, value));
+        EXPECT_TRUE(wal.write_put("small", "x"));
+    }
+
+    auto entries = WAL::read_file(test_file);
+    ASSERT_EQ(entries.size(), 2);
+    EXPECT_EQ(entries[0].key, key);
+    EXPECT_EQ(entries[0].value, value);
+    EXPECT_EQ(entries[1].key, "small");
+}
+
+TEST_F(WALTest, ConvertsOlderFormatBeforeAppending) {
+    // Two records in the format from before segment headers
+    {
+        std::ofstream out(test_file, std::ios::binary);
+        for (std::string key : {"key1", "key2"}) {
+            std::string value = "value";
+            uint16_t key_len = static_cast<uint16_t>(key.size());
+            uint16_t val_len = static_cast<uint16_t>(value.size());
+            out.put(static_cast<char>(WAL::OpType::PUT));
+            out.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
+            out.write(key.data(), key_len);
+            out.write(reinterpret_cast<const char*>(&val_len), sizeof(val_len));
+            out.write(value.data(), val_len);
+        }
+    }
+
+    {
+        WAL wal(test_file);
+        EXPECT_TRUE(wal.write_put("key3", "value3"));
+    }
+    std::ifstream in(test_file, std::ios::binary);
+    std::string magic(8, '\0');
+    in.read(&magic[0], magic.size());
+    EXPECT_EQ(magic, "MKVWAL02");
+
+    auto entries = WAL::read_file(test_file);
+    ASSERT_EQ(entries.size(), 3);
+    EXPECT_EQ(entries[0].key, "key1");
+    EXPECT_EQ(entries[0].sequence, 0u);
+    EXPECT_EQ(entries[1].value, "value");
+    EXPECT_EQ(entries[2].key, "key3");
+    EXPECT_EQ(entries[2].sequence, 1u);
+}